@@ -1,13 +1,46 @@
 #include "block.h"
 
+//the binary mesher takes solid blocks to be opaque or fluid
 const struct block_properties block_properties[BLOCK_NUM_TYPES] = {
-	[AIR] = {0, {0,0,0}, "Air"},
-	[STONE] = {1, {0.2,0.2,0.22}, "Stone"},
-	[DIRT] = {1, {0.185,0.09,0.05}, "Dirt"},
-	[GRASS] = {1, {0.05,0.27,0.1}, "Grass"},
-	[SAND] = {1, {0.28,0.3,0.15}, "Sand"},
-	[BEDROCK] = {1, {0.1,0.1,0.1}, "Hard Stone"},
-	[WATER] = {1, {0.08,0.08,0.3}, "Water"},
-	[WATER_GEN] = {1, {.8,.8,.8}, "Water Generator"},
-	[ERR] = {0, {1,0,0}, "Error"}
+	[AIR] = {0, 0, 0, 0, {0,0,0}, "Air"},
+	[STONE] = {1, 0, 1, 0, {0.2,0.2,0.22}, "Stone"},
+	[DIRT] = {1, 0, 1, 0, {0.185,0.09,0.05}, "Dirt"},
+	[GRASS] = {1, 0, 1, 0, {0.05,0.27,0.1}, "Grass"},
+	[SAND] = {1, 0, 1, 0, {0.28,0.3,0.15}, "Sand"},
+	[BEDROCK] = {1, 0, 1, 0, {0.1,0.1,0.1}, "Hard Stone"},
+	[WATER] = {1, 1, 0, 1, {0.08,0.08,0.3}, "Water"},
+	[WATER_GEN] = {1, 0, 1, 0, {.8,.8,.8}, "Water Generator"},
+	[ERR] = {0, 0, 1, 0, {1,0,0}, "Error"}
 };
+
+uint8_t block_culls[6][BLOCK_NUM_TYPES][BLOCK_NUM_TYPES];
+
+void
+block_culls_init()
+{
+	int face, self, neighbour;
+	for(face=0; face<6; ++face)
+	for(self=0; self<BLOCK_NUM_TYPES; ++self)
+	for(neighbour=0; neighbour<BLOCK_NUM_TYPES; ++neighbour)
+	{
+		int empty = !BLOCK_PROPERTY_OPAQUE(neighbour) && !BLOCK_PROPERTY_FLUID(neighbour);
+		uint8_t cull = 0;
+
+		if(face == BLOCK_FACE_UP)
+		{
+			//the surface of a fluid below the full level stays visible under anything
+			if(!empty)
+				cull = BLOCK_PROPERTY_FLUID(self) ? BLOCK_CULL_FULL_LEVEL : BLOCK_CULL_ALWAYS;
+		} else if(face == BLOCK_FACE_DOWN) {
+			if(!empty)
+				cull = BLOCK_CULL_ALWAYS;
+		} else {
+			if(BLOCK_PROPERTY_OPAQUE(neighbour))
+				cull = BLOCK_CULL_ALWAYS;
+			else if(BLOCK_PROPERTY_FLUID(neighbour) && neighbour == self)
+				cull = BLOCK_CULL_SAME_LEVEL;
+		}
+
+		block_culls[face][self][neighbour] = cull;
+	}
+}
@@ -9,15 +9,19 @@
 enum block_id {AIR = 0, STONE, DIRT, GRASS, SAND, BEDROCK, WATER, WATER_GEN, ERR};
 typedef enum block_id blockid_t;
 
+//16 bit fields keep a block at 4 bytes in dense arrays, leaves and palettes
 typedef struct {
-	blockid_t id;
+	uint16_t id;
 	union {
-		uint32_t number;
+		uint16_t number;
 	} metadata;
 } block_t;
 
 struct block_properties {
 	uint8_t solid;
+	uint8_t hasmetadata;
+	uint8_t opaque; //hides every face next to it
+	uint8_t fluid; //hides faces of the same fluid at the same level, metadata is the level
 	vec3_t color;
 	char *name;
 };
@@ -25,6 +29,22 @@ struct block_properties {
 extern const struct block_properties block_properties[BLOCK_NUM_TYPES];
 
 #define BLOCK_PROPERTY_SOLID(id) (block_properties[id].solid)
+#define BLOCK_PROPERTY_HASMETADATA(id) (block_properties[id].hasmetadata)
+#define BLOCK_PROPERTY_OPAQUE(id) (block_properties[id].opaque)
+#define BLOCK_PROPERTY_FLUID(id) (block_properties[id].fluid)
 #define BLOCK_PROPERTY_COLOR(id) (block_properties[id].color)
 
+//faces in the order chunk meshes use
+enum block_face {BLOCK_FACE_UP, BLOCK_FACE_DOWN, BLOCK_FACE_SOUTH, BLOCK_FACE_NORTH, BLOCK_FACE_EAST, BLOCK_FACE_WEST};
+
+//how a face of a block is hidden by its neighbour, the level rules only apply to fluids
+#define BLOCK_CULL_ALWAYS 1
+#define BLOCK_CULL_SAME_LEVEL 2 //when both have the same metadata
+#define BLOCK_CULL_FULL_LEVEL 4 //when the block itself is full
+
+//[face][block][neighbour], built from the properties by block_culls_init
+extern uint8_t block_culls[6][BLOCK_NUM_TYPES][BLOCK_NUM_TYPES];
+
+void block_culls_init();
+
 #endif
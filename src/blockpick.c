@@ -61,7 +61,7 @@ world_ray_pos(const vec3_t *start, const vec3_t *direction, int before, int dist
 		{
 			max.x += delta.x;
 			p.x += dirx;
-			if(BLOCK_PROPERTY_SOLID(world_block_get(p.x,p.y,p.z,0).id))
+			if(world_block_solid(p.x,p.y,p.z,0))
 			{
 				if(before)
 					p.x -= dirx;
@@ -72,7 +72,7 @@ world_ray_pos(const vec3_t *start, const vec3_t *direction, int before, int dist
 		{
 			max.y += delta.y;
 			p.y += diry;
-			if(BLOCK_PROPERTY_SOLID(world_block_get(p.x,p.y,p.z,0).id))
+			if(world_block_solid(p.x,p.y,p.z,0))
 			{
 				if(before)
 					p.y -= diry;
@@ -83,7 +83,7 @@ world_ray_pos(const vec3_t *start, const vec3_t *direction, int before, int dist
 		{
 			max.z += delta.z;
 			p.z += dirz;
-			if(BLOCK_PROPERTY_SOLID(world_block_get(p.x,p.y,p.z,0).id))
+			if(world_block_solid(p.x,p.y,p.z,0))
 			{
 				if(before)
 					p.z -= dirz;
@@ -100,7 +100,7 @@ world_ray_set(const vec3_t *start, const vec3_t *direction, block_t block, int u
 {
 	long3_t p = world_ray_pos(start, direction, before, dist);
 
-	if(!BLOCK_PROPERTY_SOLID(world_block_get(p.x,p.y,p.z,0).id) || !block.id)
+	if(!world_block_solid(p.x,p.y,p.z,0) || !block.id)
 		world_block_set(p.x, p.y, p.z, block, update, 0, 1);
 }
 
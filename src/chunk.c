@@ -5,12 +5,16 @@
 #include <string.h>
 
 #include <SDL_thread.h>
+#include <SDL_atomic.h>
+#include <SDL_timer.h>
 #include <GL/glew.h>
 #include <zlib.h>
 
 #include "world.h"
 #include "minmax.h"
 #include "octree.h"
+#include "dag.h"
+#include "palette.h"
 #include "stack.h"
 #include "noise.h"
 #include "save.h"
@@ -19,39 +23,123 @@
 typedef GLuint chunk_mesh_normal_index_t;
 #define CHUNK_MESH_NORMAL_INDEX_MAX ((CHUNKSIZE+1)*(CHUNKSIZE+1)*(CHUNKSIZE+1)*BLOCK_NUM_TYPES)
 
+//packed vertices hold 6 bits of x, y and z, 3 of face direction and 11 of block id
+#if CHUNK_LEVELS > 5 || BLOCK_NUM_TYPES > 2048
+#error "packed chunk vertices need CHUNKSIZE 32 or less and block ids below 2048"
+#endif
+#define PACKED_VERTEX(x, y, z, t, id) ((GLuint)(x) | (GLuint)(y) << 6 | (GLuint)(z) << 12 | (GLuint)(t) << 18 | (GLuint)(id) << 21)
+
+//no chunk has more quads, water of alternating levels shows five faces per block
+#define MESH_QUADS_MAX (CHUNKSIZE*CHUNKSIZE*CHUNKSIZE*6)
+
+//groups of z slabs with their own room in the mesh, an edit only reuploads its section
+#define MESH_SECTIONS 8
+#define MESH_SECTION_SLABS (CHUNKSIZE / MESH_SECTIONS)
+//a quarter more than the faces, whole triangles and quads so the zeros after them are degenerate
+#define MESH_SECTION_ROOM(n) ((n) ? ((n) + (n)/4 + 12 + 11) / 12 * 12 : 0)
+
+//chunk plus a one block border taken from the neighbours
+#define SNAPSHOT_SIZE (CHUNKSIZE+2)
+#define SNAPSHOT_INDEX(x, y, z) (((x)+1) + ((y)+1)*SNAPSHOT_SIZE + ((z)+1)*SNAPSHOT_SIZE*SNAPSHOT_SIZE)
+
+//cells of a lod mesh, with a border of one cell like the snapshot. n cells along each edge
+#define LOD_CELLS_SIZE (CHUNKSIZE/2+2)
+#define LOD_CELLS_INDEX(x, y, z, n) (((x)+1) + ((y)+1)*((n)+2) + ((z)+1)*((n)+2)*((n)+2))
+
+//solid rows are one 32 bit word along x
+#if CHUNK_LEVELS != 5
+#error "chunk solid rows need CHUNKSIZE 32"
+#endif
+#define SOLID_ROW(y, z) ((y) + (z)*CHUNKSIZE)
+
+//zero size, version, position, id and metadata
+#define UNIFORM_RECORD_SIZE (8 + 10 + 3*8 + 2 + 4)
+
 struct mesh_s {
 	GLuint element_buffer;
 
+	//kept after the upload so partial remeshes can splice into it
 	chunk_mesh_normal_index_t *elements;
+	long slabs[CHUNKSIZE+1]; //first face element of each z slab, as if the sections had no room between them
+	long sections[MESH_SECTIONS+1]; //first element of the room of each section, zeros after its faces
+	int changedsections; //bit per section that differs from the buffer
 
-	long points;
+	long points; //face elements
+	long size; //elements including the rooms, all of them are drawn
+	long uploadedpoints; //in the buffer, points may already belong to the next mesh
+	long uploadedsize;
+	long buffersize;
 
 	int uploadnext;
+	int flat; //elements came from the greedy or lod mesher
+	int uploadedflat; //and the buffer, they index the vertex table without wobble
+	enum chunk_vertex_format format; //of elements
+	enum chunk_vertex_format uploadedformat; //and of the buffer
+
+	Uint64 instantedit; //time of the oldest instant edit in elements but not uploaded, 0 for none
+};
+
+/*
+ * octree for chunks that barely change, palette for chunks with some
+ * activity and raw arrays for chunks with lots of updates
+ */
+enum chunk_storage {
+	CHUNK_STORAGE_OCTREE,
+	CHUNK_STORAGE_PALETTE,
+	CHUNK_STORAGE_RAW
+};
+
+//kept by each meshing thread so remeshes don't allocate
+struct chunk_mesh_scratch {
+	block_t snapshot[SNAPSHOT_SIZE*SNAPSHOT_SIZE*SNAPSHOT_SIZE];
+	block_t cells[LOD_CELLS_SIZE*LOD_CELLS_SIZE*LOD_CELLS_SIZE];
+	block_t border[CHUNKSIZE*CHUNKSIZE << CHUNK_LOD_MAX]; //the cells of a neighbour along a face
+	chunk_mesh_normal_index_t elements[MESH_QUADS_MAX*6]; //enough for any chunk in either format
 };
 
 struct chunk {
 	long3_t pos;
 
 	octree_t *data;
-	block_t *rawblocks;
+	palette_t *palette;
+	uint16_t *rawids;
+	uint16_t *rawmetadata; //only allocated once a block with metadata is set
 
 	update_stack_t *updates;
 	struct update_node *rawupdates;
 
-	int iscompressed;
+	enum chunk_storage storage;
+	size_t accounted; //bytes counted in uncompressedbytes
+
+	//accesses since the last tick, and decaying sums of them
+	SDL_atomic_t reads;
+	SDL_atomic_t writes;
+	uint32_t readheat;
+	uint32_t writeheat;
+
+	uint32_t solid[CHUNKSIZE*CHUNKSIZE]; //bit x of row SOLID_ROW(y, z) is set for solid blocks
+	uint32_t fluid[CHUNKSIZE*CHUNKSIZE]; //and here for fluid ones
 
 	struct mesh_s mesh;
 	int iscurrent;
 
+	//blocks changed since the last remesh, high is exclusive
+	int3_t dirtylow;
+	int3_t dirtyhigh;
+	int modified; //since it was loaded, generated or saved
+	int lod; //meshed in cells of 2^lod blocks
+	uint8_t visibility[6]; //bit f of visibility[t] is set when face t sees face f through the chunk
+	Uint64 instantedit; //time of the oldest instant edit not meshed yet, 0 for none
+
 	SDL_mutex *externallock;
 
-	SDL_mutex *mutex_read;
-	SDL_sem *sem_write;
-	int readers;
+	SDL_atomic_t rwlock; //number of readers, or -1 while written
+	SDL_atomic_t writerswaiting;
 };
 
-static int numuncompressed = 0;
+static SDL_atomic_t uncompressedbytes;
 
+//corners v0 v1 v2 then v3 v2 v1 of each face, packed quads keep the first four
 const static int faces[] = {
 //top
 0,1,0,
@@ -94,9 +182,9 @@ const static int faces[] = {
 1,1,1,
 1,0,0,
 
+1,0,1,
 1,0,0,
 1,1,1,
-1,0,1,
 
 //west
 0,1,0,
@@ -109,46 +197,151 @@ const static int faces[] = {
 };
 
 static GLuint index_buffer_vertices = 0;
+static GLuint index_buffer_vertices_flat = 0; //for greedy and lod quads
 static GLuint index_buffer_colors = 0;
 
+static GLuint packed_quad_indices = 0; //0 1 2 3 2 1 for each quad of packed vertices
+static GLuint packed_colors = 0; //texture of block ids by face direction
+
+static enum chunk_mesher mesher = CHUNK_MESHER_FACES;
+static enum chunk_vertex_format vertexformat = CHUNK_VERTEX_INDEXED;
+static SDL_atomic_t remeshcount;
+static SDL_atomic_t remeshus;
+static SDL_atomic_t editcount; //instant edits uploaded
+static SDL_atomic_t editus; //from the edit to the upload
+static SDL_atomic_t editmaxus;
+
+/*
+ * readers and writers spin on one atomic instead of a mutex, and sleep
+ * only when the lock stays taken. A waiting writer holds off new readers
+ * so water updates and remeshes are not starved by physics and raycasts.
+ */
+static inline void
+lock_backoff(int *spins)
+{
+	if(++(*spins) > CHUNK_LOCK_SPINS)
+		SDL_Delay(*spins > CHUNK_LOCK_SPINS*2 ? 1 : 0);
+}
+
 static void
 lock_read(chunk_t *chunk)
 {
-	SDL_LockMutex(chunk->mutex_read);
-	chunk->readers++;
-	if(chunk->readers == 1)
-		SDL_SemWait(chunk->sem_write);
-
-	SDL_UnlockMutex(chunk->mutex_read);
+	int spins = 0;
+	while(1)
+	{
+		int readers = SDL_AtomicGet(&chunk->rwlock);
+		if(readers >= 0 && !SDL_AtomicGet(&chunk->writerswaiting) && SDL_AtomicCAS(&chunk->rwlock, readers, readers + 1))
+			return;
+		lock_backoff(&spins);
+	}
 }
 
 static void
 unlock_read(chunk_t *chunk)
 {
-	SDL_LockMutex(chunk->mutex_read);
-	chunk->readers--;
-	if(chunk->readers == 0)
-		SDL_SemPost(chunk->sem_write);
+	if(SDL_AtomicAdd(&chunk->rwlock, -1) <= 0)
+		error("chunk unlock_read(): too many unlocks");
+}
 
-	if(chunk->readers < 0)
+static void
+lock_write(chunk_t *chunk)
+{
+	int spins = 0;
+	SDL_AtomicIncRef(&chunk->writerswaiting);
+	while(!SDL_AtomicCAS(&chunk->rwlock, 0, -1))
+		lock_backoff(&spins);
+	SDL_AtomicAdd(&chunk->writerswaiting, -1);
+}
+
+static void
+unlock_write(chunk_t *chunk)
+{
+	SDL_AtomicSet(&chunk->rwlock, 0);
+}
+
+//new contents start cold, whatever the chunk held before
+static void
+clear_heat(chunk_t *chunk)
+{
+	SDL_AtomicSet(&chunk->reads, 0);
+	SDL_AtomicSet(&chunk->writes, 0);
+	chunk->readheat = 0;
+	chunk->writeheat = 0;
+}
+
+static void
+mark_dirty(chunk_t *chunk, int3_t low, int3_t high)
+{
+	chunk->dirtylow.x = imax(imin(chunk->dirtylow.x, low.x), 0);
+	chunk->dirtylow.y = imax(imin(chunk->dirtylow.y, low.y), 0);
+	chunk->dirtylow.z = imax(imin(chunk->dirtylow.z, low.z), 0);
+	chunk->dirtyhigh.x = imin(imax(chunk->dirtyhigh.x, high.x), CHUNKSIZE);
+	chunk->dirtyhigh.y = imin(imax(chunk->dirtyhigh.y, high.y), CHUNKSIZE);
+	chunk->dirtyhigh.z = imin(imax(chunk->dirtyhigh.z, high.z), CHUNKSIZE);
+}
+
+static void
+mark_all_dirty(chunk_t *chunk)
+{
+	int3_t low = {0, 0, 0};
+	int3_t high = {CHUNKSIZE, CHUNKSIZE, CHUNKSIZE};
+	mark_dirty(chunk, low, high);
+}
+
+static void
+clear_dirty(chunk_t *chunk)
+{
+	chunk->dirtylow.x = chunk->dirtylow.y = chunk->dirtylow.z = CHUNKSIZE;
+	chunk->dirtyhigh.x = chunk->dirtyhigh.y = chunk->dirtyhigh.z = 0;
+}
+
+static inline void
+rows_set(chunk_t *chunk, int x, int y, int z, blockid_t id)
+{
+	uint32_t bit = (uint32_t)1 << x;
+	if(BLOCK_PROPERTY_SOLID(id))
+		chunk->solid[SOLID_ROW(y, z)] |= bit;
+	else
+		chunk->solid[SOLID_ROW(y, z)] &= ~bit;
+
+	if(BLOCK_PROPERTY_FLUID(id))
+		chunk->fluid[SOLID_ROW(y, z)] |= bit;
+	else
+		chunk->fluid[SOLID_ROW(y, z)] &= ~bit;
+}
+
+static void
+rows_fill_box(chunk_t *chunk, int3_t low, int3_t high, blockid_t id)
+{
+	int width = high.x - low.x;
+	uint32_t mask = (width == 32 ? ~(uint32_t)0 : ((uint32_t)1 << width) - 1) << low.x;
+	int y, z;
+	for(z=low.z; z<high.z; ++z)
+	for(y=low.y; y<high.y; ++y)
 	{
-		//TODO: error
-		chunk->readers = 0;
-		printf("Semaphore: too many unlocks\n");
+		if(BLOCK_PROPERTY_SOLID(id))
+			chunk->solid[SOLID_ROW(y, z)] |= mask;
+		else
+			chunk->solid[SOLID_ROW(y, z)] &= ~mask;
+
+		if(BLOCK_PROPERTY_FLUID(id))
+			chunk->fluid[SOLID_ROW(y, z)] |= mask;
+		else
+			chunk->fluid[SOLID_ROW(y, z)] &= ~mask;
 	}
-	SDL_UnlockMutex(chunk->mutex_read);
 }
 
 static void
-lock_write(chunk_t *chunk)
+rows_fill_leaf(const octree_box_t *bounds, block_t block, void *ptr)
 {
-	SDL_SemWait(chunk->sem_write);
+	rows_fill_box(ptr, bounds->low, bounds->high, block.id);
 }
 
 static void
-unlock_write(chunk_t *chunk)
+rows_from_octree(chunk_t *chunk)
 {
-	SDL_SemPost(chunk->sem_write);
+	octree_box_t all = {{0, 0, 0}, {CHUNKSIZE, CHUNKSIZE, CHUNKSIZE}};
+	octree_visit_leaves(chunk->data, &all, rows_fill_leaf, chunk);
 }
 
 static void
@@ -159,55 +352,65 @@ init_chunk(chunk_t *chunk)
 	chunk->updates = update_stack_create();
 	chunk->mesh.uploadnext = 0;
 	chunk->mesh.points = 0;
+	chunk->mesh.size = 0;
+	chunk->mesh.uploadedpoints = 0;
+	chunk->mesh.uploadedsize = 0;
+	chunk->mesh.buffersize = 0;
+	chunk->mesh.changedsections = 0;
+	chunk->mesh.elements = 0;
+	chunk->mesh.flat = 0;
+	chunk->mesh.uploadedflat = 0;
+	chunk->lod = 0;
+	memset(chunk->visibility, (1 << 6) - 1, sizeof(chunk->visibility));
+	chunk->mesh.format = CHUNK_VERTEX_INDEXED;
+	chunk->mesh.uploadedformat = CHUNK_VERTEX_INDEXED;
+	chunk->mesh.instantedit = 0;
+	chunk->instantedit = 0;
+	memset(chunk->mesh.slabs, 0, sizeof(chunk->mesh.slabs));
+	memset(chunk->mesh.sections, 0, sizeof(chunk->mesh.sections));
+	memset(chunk->solid, 0, sizeof(chunk->solid));
+	memset(chunk->fluid, 0, sizeof(chunk->fluid));
 	chunk->iscurrent = 0;
-	chunk->iscompressed = 1;
+	clear_dirty(chunk);
+	mark_all_dirty(chunk);
+	chunk->modified = 0;
+	chunk->storage = CHUNK_STORAGE_OCTREE;
+	chunk->palette = 0;
+	chunk->accounted = 0;
+	clear_heat(chunk);
 	chunk->externallock = SDL_CreateMutex();
-	chunk->mutex_read = SDL_CreateMutex();
-	chunk->sem_write = SDL_CreateSemaphore(1);
-	chunk->readers = 0;
+	SDL_AtomicSet(&chunk->rwlock, 0);
+	SDL_AtomicSet(&chunk->writerswaiting, 0);
 }
 
+/*
+ * raw and palette chunks count against CHUNK_UNCOMPRESSED_BUDGET, octrees
+ * are small and shared so they do not
+ */
+#define RAW_BYTES (CHUNKSIZE*CHUNKSIZE*CHUNKSIZE * (sizeof(uint16_t) + sizeof(struct update_node))) /* without metadata */
+
 static void
-compress_chunk(chunk_t *chunk)
+account(chunk_t *chunk)
 {
-	if(chunk->iscompressed)
-		return;
-
-	int x, y, z;
-	for(x=0; x<CHUNKSIZE; ++x)
-	for(y=0; y<CHUNKSIZE; ++y)
-	for(z=0; z<CHUNKSIZE; ++z)
-	{
-		octree_set(x, y, z, chunk->data, &chunk->rawblocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE]);
-		struct update_node *update = &chunk->rawupdates[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE];
-		if(update->time >= 0)
-			update_queue(chunk->updates, update->pos.x, update->pos.y, update->pos.z, update->time, update->flags);
-	}
-
-	chunk->iscompressed = 1;
-
-	free(chunk->rawblocks);
-	free(chunk->rawupdates);
-	numuncompressed--;
+	size_t size = 0;
+	if(chunk->storage == CHUNK_STORAGE_RAW)
+		size = RAW_BYTES +
+			(chunk->rawmetadata ? CHUNKSIZE*CHUNKSIZE*CHUNKSIZE * sizeof(uint16_t) : 0);
+	else if(chunk->storage == CHUNK_STORAGE_PALETTE)
+		size = palette_memory_get(chunk->palette);
+
+	SDL_AtomicAdd(&uncompressedbytes, (int)size - (int)chunk->accounted);
+	chunk->accounted = size;
 }
 
 static void
-uncompress_chunk(chunk_t *chunk)
+updates_to_raw(chunk_t *chunk)
 {
-	if(!chunk->iscompressed)
-		return;
-
-	chunk->rawblocks = malloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE* sizeof(block_t));
 	chunk->rawupdates = malloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE* sizeof(struct update_node));
 
-	int x, y, z;
-	for(x=0; x<CHUNKSIZE; ++x)
-	for(y=0; y<CHUNKSIZE; ++y)
-	for(z=0; z<CHUNKSIZE; ++z)
-	{
-		chunk->rawblocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE] = octree_get(x, y, z, chunk->data);
-		chunk->rawupdates[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE].time = -1;
-	}
+	int i;
+	for(i=0; i<CHUNKSIZE*CHUNKSIZE*CHUNKSIZE; ++i)
+		chunk->rawupdates[i].time = -1;
 
 	if(chunk->updates)
 	{
@@ -227,38 +430,215 @@ uncompress_chunk(chunk_t *chunk)
 
 		chunk->updates->queue = 0;
 	}
+}
+
+static void
+updates_from_raw(chunk_t *chunk)
+{
+	int i;
+	for(i=0; i<CHUNKSIZE*CHUNKSIZE*CHUNKSIZE; ++i)
+	{
+		struct update_node *update = &chunk->rawupdates[i];
+		if(update->time >= 0)
+			update_queue(chunk->updates, update->pos.x, update->pos.y, update->pos.z, update->time, update->flags);
+	}
+
+	free(chunk->rawupdates);
+}
+
+static void
+raw_from_dense(chunk_t *chunk, const block_t *blocks)
+{
+	chunk->rawids = malloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE * sizeof(uint16_t));
+	chunk->rawmetadata = 0;
+
+	int i;
+	for(i=0; i<CHUNKSIZE*CHUNKSIZE*CHUNKSIZE; ++i)
+	{
+		chunk->rawids[i] = blocks[i].id;
+		if(blocks[i].metadata.number && !chunk->rawmetadata)
+			chunk->rawmetadata = calloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE, sizeof(uint16_t));
+		if(chunk->rawmetadata)
+			chunk->rawmetadata[i] = blocks[i].metadata.number;
+	}
+}
+
+static void
+storage_to_dense(chunk_t *chunk, block_t *blocks)
+{
+	int i;
+	switch(chunk->storage)
+	{
+		case CHUNK_STORAGE_RAW:
+			for(i=0; i<CHUNKSIZE*CHUNKSIZE*CHUNKSIZE; ++i)
+			{
+				blocks[i].id = chunk->rawids[i];
+				blocks[i].metadata.number = chunk->rawmetadata ? chunk->rawmetadata[i] : 0;
+			}
+			break;
+		case CHUNK_STORAGE_PALETTE:
+			palette_to_dense(chunk->palette, blocks);
+			break;
+		default:
+			octree_to_dense(chunk->data, blocks);
+			break;
+	}
+}
 
-	chunk->iscompressed = 0;
-	numuncompressed++;
+/*
+ * moves the blocks and pending updates of a chunk to another representation.
+ * Falls back to the octree when there are too many distinct blocks for a
+ * palette. Needs the write lock.
+ */
+static void
+convert_chunk(chunk_t *chunk, enum chunk_storage storage)
+{
+	if(chunk->storage == storage)
+		return;
+
+	block_t *blocks = malloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE * sizeof(block_t));
+	storage_to_dense(chunk, blocks);
+	switch(chunk->storage)
+	{
+		case CHUNK_STORAGE_RAW:
+			free(chunk->rawids);
+			free(chunk->rawmetadata);
+			break;
+		case CHUNK_STORAGE_PALETTE:
+			palette_destroy(chunk->palette);
+			chunk->palette = 0;
+			break;
+		default:
+			octree_destroy(chunk->data);
+			chunk->data = 0;
+			break;
+	}
+
+	if(storage == CHUNK_STORAGE_PALETTE)
+	{
+		chunk->palette = palette_create_from_dense(blocks);
+		if(!chunk->palette)
+			storage = CHUNK_STORAGE_OCTREE;
+	}
+	if(storage == CHUNK_STORAGE_OCTREE)
+		chunk->data = octree_build_from_dense(blocks);
+
+	if(storage == CHUNK_STORAGE_RAW)
+	{
+		raw_from_dense(chunk, blocks);
+		updates_to_raw(chunk);
+	} else if(chunk->storage == CHUNK_STORAGE_RAW) {
+		updates_from_raw(chunk);
+	}
+	free(blocks);
+
+	chunk->storage = storage;
+	account(chunk);
+}
+
+/*
+ * throws away the contents without converting them, for when they are
+ * about to be replaced anyway. Leaves an empty octree.
+ */
+static void
+drop_storage(chunk_t *chunk)
+{
+	switch(chunk->storage)
+	{
+		case CHUNK_STORAGE_RAW:
+			free(chunk->rawids);
+			free(chunk->rawmetadata);
+			free(chunk->rawupdates);
+			break;
+		case CHUNK_STORAGE_PALETTE:
+			palette_destroy(chunk->palette);
+			chunk->palette = 0;
+			break;
+		default:
+			return;
+	}
+
+	chunk->data = octree_create();
+	chunk->storage = CHUNK_STORAGE_OCTREE;
+	account(chunk);
+}
+
+//only octrees collapse into a single leaf, needs at least the read lock
+static inline int
+is_uniform(chunk_t *chunk, block_t *block)
+{
+	return chunk->storage == CHUNK_STORAGE_OCTREE && octree_uniform_get(chunk->data, block);
 }
 
 inline static block_t
 get_block(chunk_t *c, int x, int y, int z)
 {
 	block_t ret;
-	if(c->iscompressed)
-		ret = octree_get(x, y, z, c->data);
-	else
-		ret = c->rawblocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE];
+	switch(c->storage)
+	{
+		case CHUNK_STORAGE_RAW:
+		{
+			int i = x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE;
+			ret.id = c->rawids[i];
+			ret.metadata.number = c->rawmetadata ? c->rawmetadata[i] : 0;
+		}
+			break;
+		case CHUNK_STORAGE_PALETTE:
+			ret = palette_get(x, y, z, c->palette);
+			break;
+		default:
+			ret = octree_get(x, y, z, c->data);
+			break;
+	}
 	return ret;
 }
 
 inline static void
 set_block(chunk_t *c, int x, int y, int z, block_t b)
 {
-	if(c->iscompressed)
-		octree_set(x, y, z, c->data, &b);
-	else
-		c->rawblocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE] = b;
+	int3_t low = {x, y, z};
+	int3_t high = {x+1, y+1, z+1};
+	mark_dirty(c, low, high);
+	c->modified = 1;
+	rows_set(c, x, y, z, b.id);
+
+	switch(c->storage)
+	{
+		case CHUNK_STORAGE_RAW:
+		{
+			int i = x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE;
+			c->rawids[i] = b.id;
+			if(b.metadata.number && !c->rawmetadata)
+				c->rawmetadata = calloc(CHUNKSIZE*CHUNKSIZE*CHUNKSIZE, sizeof(uint16_t));
+			if(c->rawmetadata)
+				c->rawmetadata[i] = b.metadata.number;
+		}
+			break;
+		case CHUNK_STORAGE_PALETTE:
+			if(palette_set(x, y, z, c->palette, &b) == BLOCKS_SUCCESS)
+				break;
+			//palette is full
+			convert_chunk(c, CHUNK_STORAGE_OCTREE);
+			octree_set(x, y, z, c->data, &b);
+			break;
+		default:
+			octree_set(x, y, z, c->data, &b);
+			break;
+	}
 }
 
 void
 chunk_static_init()
 {
+	dag_static_init();
+	block_culls_init();
+
 	glGenBuffers(1, &index_buffer_vertices);
+	glGenBuffers(1, &index_buffer_vertices_flat);
 	glGenBuffers(1, &index_buffer_colors);
 
 	GLfloat *vertices = malloc(CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat));
+	GLfloat *flat = malloc(CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat));
 	GLfloat *colors = malloc(CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat));
 
 	int i = 0;
@@ -270,14 +650,17 @@ chunk_static_init()
 	for(x = 0; x<CHUNKSIZE+1; ++x)
 	{
 		vertices[i] = x + ((int)(noise3D(x%(CHUNKSIZE), y%(CHUNKSIZE), z%(CHUNKSIZE), 1) % 100) - 50) * (RENDER_WOBBLE / 100.0f);
+		flat[i] = x;
 		colors[i] = block_properties[id].color.x;
 		++i;
 
 		vertices[i] = y + ((int)(noise3D(y%(CHUNKSIZE), z%(CHUNKSIZE), x%(CHUNKSIZE), 1) % 100) - 50) * (RENDER_WOBBLE / 100.0f);
+		flat[i] = y;
 		colors[i] = block_properties[id].color.y;
 		++i;
 
 		vertices[i] = z + ((int)(noise3D(z%(CHUNKSIZE), x%(CHUNKSIZE), y%(CHUNKSIZE), 1) % 100) - 50) * (RENDER_WOBBLE / 100.0f);
+		flat[i] = z;
 		colors[i] = block_properties[id].color.z;
 		++i;
 	}
@@ -286,49 +669,148 @@ chunk_static_init()
 	glBufferData(GL_ARRAY_BUFFER, CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
 	free(vertices);
 
+	glBindBuffer(GL_ARRAY_BUFFER, index_buffer_vertices_flat);
+	glBufferData(GL_ARRAY_BUFFER, CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat), flat, GL_STATIC_DRAW);
+	free(flat);
+
 	glBindBuffer(GL_ARRAY_BUFFER, index_buffer_colors);
 	glBufferData(GL_ARRAY_BUFFER, CHUNK_MESH_NORMAL_INDEX_MAX * 3 * sizeof(GLfloat), colors, GL_STATIC_DRAW);
 	free(colors);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//packed vertices only need the order of each quads corners and a colour per block and face
+	GLuint *quads = malloc(MESH_QUADS_MAX * 6 * sizeof(GLuint));
+	static const GLuint pattern[6] = {0, 1, 2, 3, 2, 1};
+	for(i=0; i<MESH_QUADS_MAX * 6; ++i)
+		quads[i] = i/6*4 + pattern[i%6];
+
+	glGenBuffers(1, &packed_quad_indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packed_quad_indices);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, MESH_QUADS_MAX * 6 * sizeof(GLuint), quads, GL_STATIC_DRAW);
+	free(quads);
+
+	GLfloat blockcolors[6][BLOCK_NUM_TYPES][3];
+	int t;
+	for(t=0; t<6; ++t)
+	for(id=0; id<BLOCK_NUM_TYPES; ++id)
+	{
+		blockcolors[t][id][0] = block_properties[id].color.x;
+		blockcolors[t][id][1] = block_properties[id].color.y;
+		blockcolors[t][id][2] = block_properties[id].color.z;
+	}
+
+	glGenTextures(1, &packed_colors);
+	glBindTexture(GL_TEXTURE_2D, packed_colors);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, BLOCK_NUM_TYPES, 6, 0, GL_RGB, GL_FLOAT, blockcolors);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void
 chunk_static_cleanup()
 {
 	glDeleteBuffers(1, &index_buffer_vertices);
+	glDeleteBuffers(1, &index_buffer_vertices_flat);
 	glDeleteBuffers(1, &index_buffer_colors);
+	glDeleteBuffers(1, &packed_quad_indices);
+	glDeleteTextures(1, &packed_colors);
+
+	dag_static_cleanup();
 }
 
-long
-chunk_render(chunk_t *chunk)
+void
+chunk_upload(chunk_t *chunk)
 {
 	if(chunk->mesh.uploadnext)
 	{
 		lock_read(chunk);
 		if(chunk->mesh.uploadnext)
 		{
-			if(chunk->mesh.points > 0)
+			if(chunk->mesh.size > 0)
 			{
 				//if(chunk->mesh.element_buffer == 0)
 					//glCreateBuffers(1, &chunk->mesh.element_buffer);
 
 				glBindBuffer(GL_ARRAY_BUFFER, chunk->mesh.element_buffer);
-				glBufferData(GL_ARRAY_BUFFER, chunk->mesh.points * sizeof(chunk_mesh_normal_index_t), chunk->mesh.elements, GL_STATIC_DRAW);
-				free(chunk->mesh.elements);
+				if(chunk->mesh.size > chunk->mesh.buffersize || chunk->mesh.size < chunk->mesh.buffersize / 4)
+				{
+					glBufferData(GL_ARRAY_BUFFER, chunk->mesh.size * sizeof(chunk_mesh_normal_index_t), chunk->mesh.elements, GL_DYNAMIC_DRAW);
+					chunk->mesh.buffersize = chunk->mesh.size;
+				} else {
+					int s;
+					for(s=0; s<MESH_SECTIONS; ++s)
+						if(chunk->mesh.changedsections & 1 << s)
+							glBufferSubData(GL_ARRAY_BUFFER, chunk->mesh.sections[s] * sizeof(chunk_mesh_normal_index_t),
+									(chunk->mesh.sections[s+1] - chunk->mesh.sections[s]) * sizeof(chunk_mesh_normal_index_t),
+									chunk->mesh.elements + chunk->mesh.sections[s]);
+				}
+				chunk->mesh.changedsections = 0;
+				chunk->mesh.uploadedflat = chunk->mesh.flat;
+				chunk->mesh.uploadedformat = chunk->mesh.format;
 			} else if(chunk->mesh.element_buffer)
 			{
 				//glDeleteBuffers(1, &chunk->mesh.element_buffer);
 			}
 
+			chunk->mesh.uploadedpoints = chunk->mesh.points;
+			chunk->mesh.uploadedsize = chunk->mesh.size;
 			chunk->mesh.uploadnext = 0;
+
+			//the edit shows from this frame on
+			if(chunk->mesh.instantedit)
+			{
+				long us = (SDL_GetPerformanceCounter() - chunk->mesh.instantedit) * 1000000 / SDL_GetPerformanceFrequency();
+				chunk->mesh.instantedit = 0;
+
+				SDL_AtomicIncRef(&editcount);
+				SDL_AtomicAdd(&editus, us);
+				int max = SDL_AtomicGet(&editmaxus);
+				while(us > max && !SDL_AtomicCAS(&editmaxus, max, us))
+					max = SDL_AtomicGet(&editmaxus);
+			}
 		}
 		unlock_read(chunk);
 	}
+}
+
+long
+chunk_render(chunk_t *chunk, GLint packeduniform)
+{
+	chunk_upload(chunk);
+
+	if(chunk->mesh.uploadedsize <= 0)
+		return 0;
+
+	if(chunk->mesh.uploadedformat == CHUNK_VERTEX_PACKED)
+	{
+		//four vertices a quad, expanded to two triangles by the shared indices
+		long quads = chunk->mesh.uploadedsize / 4;
+
+		glUniform1i(packeduniform, 1);
+		glDisableVertexAttribArray(0);
+		glDisableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, packed_colors);
+
+		glBindBuffer(GL_ARRAY_BUFFER, chunk->mesh.element_buffer);
+		glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packed_quad_indices);
+		glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_INT, 0);
+
+		return chunk->mesh.uploadedpoints / 4 * 6;
+	}
 
-	if(chunk->mesh.points > 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, index_buffer_vertices);
+		glUniform1i(packeduniform, 0);
+		glDisableVertexAttribArray(2);
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, chunk->mesh.uploadedflat ? index_buffer_vertices_flat : index_buffer_vertices);
 		glVertexAttribPointer(
 				0,
 				3,
@@ -346,227 +828,915 @@ chunk_render(chunk_t *chunk)
 				0,
 				0);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk->mesh.element_buffer);
-		glDrawElements(GL_TRIANGLES, chunk->mesh.points, GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, chunk->mesh.uploadedsize, GL_UNSIGNED_INT, 0);
 	}
 
-	return chunk->mesh.points;
+	return chunk->mesh.uploadedpoints;
 }
 
-void
-chunk_remesh(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest)
+struct box_copy_s {
+	block_t *out; //element for low
+	int3_t low;
+	int stridey;
+	int stridez;
+};
+
+static void
+box_copy_leaf(const octree_box_t *bounds, block_t block, void *ptr)
 {
-	chunk_lock(chunk);
+	struct box_copy_s *copy = ptr;
+	int x, y, z;
+	for(z=bounds->low.z; z<bounds->high.z; ++z)
+	for(y=bounds->low.y; y<bounds->high.y; ++y)
+	{
+		block_t *row = copy->out + (y - copy->low.y)*copy->stridey + (z - copy->low.z)*copy->stridez - copy->low.x;
+		for(x=bounds->low.x; x<bounds->high.x; ++x)
+			row[x] = block;
+	}
+}
+
+static void
+copy_box(chunk_t *chunk, int3_t low, int3_t high, block_t *out, int stridey, int stridez)
+{
+	if(chunk->storage == CHUNK_STORAGE_OCTREE)
+	{
+		struct box_copy_s copy = {out, low, stridey, stridez};
+		octree_box_t box = {low, high};
+		octree_visit_leaves(chunk->data, &box, box_copy_leaf, &copy);
+	} else {
+		int x, y, z;
+		for(z=low.z; z<high.z; ++z)
+		for(y=low.y; y<high.y; ++y)
+		{
+			block_t *row = out + (y - low.y)*stridey + (z - low.z)*stridez - low.x;
+			for(x=low.x; x<high.x; ++x)
+				row[x] = get_block(chunk, x, y, z);
+		}
+	}
+}
+
+struct snapshot_layer_s {
+	block_t *snapshot;
+	int axis;
+	int to;
+};
+
+static void
+snapshot_layer_leaf(const octree_box_t *bounds, block_t block, void *ptr)
+{
+	struct snapshot_layer_s *layer = ptr;
+	int a = (layer->axis+1)%3;
+	int b = (layer->axis+2)%3;
+	const int *low = &bounds->low.x;
+	const int *high = &bounds->high.x;
+
+	int dst[3];
+	dst[layer->axis] = layer->to;
+	for(dst[a] = low[a]; dst[a] < high[a]; ++dst[a])
+	for(dst[b] = low[b]; dst[b] < high[b]; ++dst[b])
+		layer->snapshot[SNAPSHOT_INDEX(dst[0], dst[1], dst[2])] = block;
+}
+
+/*
+ * copies one layer of a neighbour into the padding of a snapshot. `from` is
+ * the neighbours coordinate along `axis`, `to` the snapshots.
+ */
+static void
+snapshot_layer(block_t *snapshot, chunk_t *neighbour, int axis, int from, int to)
+{
+	if(!neighbour)
+		return;
+
+	struct snapshot_layer_s layer = {snapshot, axis, to};
+	octree_box_t box = {{0, 0, 0}, {CHUNKSIZE, CHUNKSIZE, CHUNKSIZE}};
+	(&box.low.x)[axis] = from;
+	(&box.high.x)[axis] = from + 1;
+
+	lock_read(neighbour);
+
+	if(neighbour->storage == CHUNK_STORAGE_OCTREE)
+	{
+		octree_visit_leaves(neighbour->data, &box, snapshot_layer_leaf, &layer);
+	} else {
+		int u, v;
+		for(u=0; u<CHUNKSIZE; ++u)
+		for(v=0; v<CHUNKSIZE; ++v)
+		{
+			int src[3], dst[3];
+			src[axis] = from;
+			dst[axis] = to;
+			src[(axis+1)%3] = dst[(axis+1)%3] = u;
+			src[(axis+2)%3] = dst[(axis+2)%3] = v;
+
+			snapshot[SNAPSHOT_INDEX(dst[0], dst[1], dst[2])] = get_block(neighbour, src[0], src[1], src[2]);
+		}
+	}
+
+	unlock_read(neighbour);
+}
+
+/*
+ * fills a SNAPSHOT_SIZE^3 array with the z slabs zlow to zhigh of the chunk
+ * and the faces of its neighbours that touch it, and rows and fluidrows with
+ * the solid and fluid rows of the chunk. Each chunk is locked once, and
+ * missing neighbours read as air.
+ */
+static void
+snapshot_build(block_t *snapshot, uint32_t *rows, uint32_t *fluidrows, int zlow, int zhigh, chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest)
+{
+	memset(snapshot, 0, SNAPSHOT_SIZE*SNAPSHOT_SIZE*SNAPSHOT_SIZE * sizeof(block_t));
+
+	int3_t low = {0, 0, zlow};
+	int3_t high = {CHUNKSIZE, CHUNKSIZE, zhigh};
 	lock_read(chunk);
+	copy_box(chunk, low, high, &snapshot[SNAPSHOT_INDEX(0, 0, zlow)], SNAPSHOT_SIZE, SNAPSHOT_SIZE*SNAPSHOT_SIZE);
+	memcpy(rows, chunk->solid, sizeof(chunk->solid));
+	memcpy(fluidrows, chunk->fluid, sizeof(chunk->fluid));
+	unlock_read(chunk);
+
+	snapshot_layer(snapshot, chunkabove, 1, 0, CHUNKSIZE);
+	snapshot_layer(snapshot, chunkbelow, 1, CHUNKSIZE-1, -1);
+	snapshot_layer(snapshot, chunksouth, 2, 0, CHUNKSIZE);
+	snapshot_layer(snapshot, chunknorth, 2, CHUNKSIZE-1, -1);
+	snapshot_layer(snapshot, chunkeast, 0, 0, CHUNKSIZE);
+	snapshot_layer(snapshot, chunkwest, 0, CHUNKSIZE-1, -1);
+}
+
+//the axis each of the six faces points along, and the step to the neighbour in a snapshot
+static const int face_axis[6] = {1, 1, 2, 2, 0, 0};
+static const int face_step[6][3] = {{0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {-1, 0, 0}};
+static const int face_offset[6] = {SNAPSHOT_SIZE, -SNAPSHOT_SIZE, SNAPSHOT_SIZE*SNAPSHOT_SIZE, -SNAPSHOT_SIZE*SNAPSHOT_SIZE, 1, -1};
 
-	if(chunkabove)
-		lock_read(chunkabove);
-	if(chunkbelow)
-		lock_read(chunkbelow);
-	if(chunknorth)
-		lock_read(chunknorth);
-	if(chunksouth)
-		lock_read(chunksouth);
-	if(chunkeast)
-		lock_read(chunkeast);
-	if(chunkwest)
-		lock_read(chunkwest);
-
-	stack_t *elements = stack_create(sizeof(chunk_mesh_normal_index_t), 1000, 2.0); //TODO: better constants
+//one load from the cull table, the levels only matter to fluids
+static inline int
+face_hidden(block_t block, block_t neighbour, int t)
+{
+	int levels = BLOCK_CULL_ALWAYS |
+		(block.metadata.number == neighbour.metadata.number) * BLOCK_CULL_SAME_LEVEL |
+		(block.metadata.number == SIM_WATER_LEVELS) * BLOCK_CULL_FULL_LEVEL;
+	return block_culls[t][block.id][neighbour.id] & levels;
+}
 
+/*
+ * sets the padding toward face t to air where the neighbour there draws an air
+ * cell. A neighbour meshed in cells draws them by the majority of their
+ * blocks, so the layer it touches can have blocks where it draws none. border
+ * holds the cells of the neighbour along the face.
+ */
+static void
+snapshot_clear_cells(block_t *snapshot, block_t *border, chunk_t *neighbour, int t)
+{
+	int lod = imin(neighbour->lod, CHUNK_LOD_MAX);
+	int size = 1 << lod;
+	int axis = face_axis[t];
+	int a = (axis+1)%3;
+	int b = (axis+2)%3;
+
+	int3_t low = {0, 0, 0};
+	int3_t high = {CHUNKSIZE, CHUNKSIZE, CHUNKSIZE};
+	(&low.x)[axis] = t % 2 ? CHUNKSIZE - size : 0;
+	(&high.x)[axis] = (&low.x)[axis] + size;
+	int stridey = high.x - low.x;
+	int stridez = stridey * (high.y - low.y);
+
+	lock_read(neighbour);
+	copy_box(neighbour, low, high, border, stridey, stridez);
+	unlock_read(neighbour);
+
+	int u, v, x, y, d;
+	for(u=0; u<CHUNKSIZE; u+=size)
+	for(v=0; v<CHUNKSIZE; v+=size)
+	{
+		int count = 0;
+		int p[3];
+		for(d=0; d<size; ++d)
+		for(x=0; x<size; ++x)
+		for(y=0; y<size; ++y)
+		{
+			p[axis] = d;
+			p[a] = u + x;
+			p[b] = v + y;
+			count += border[p[0] + p[1]*stridey + p[2]*stridez].id != AIR;
+		}
+		if(count * 2 >= size*size*size)
+			continue;
+
+		p[axis] = t % 2 ? -1 : CHUNKSIZE;
+		for(x=0; x<size; ++x)
+		for(y=0; y<size; ++y)
+		{
+			p[a] = u + x;
+			p[b] = v + y;
+			snapshot[SNAPSHOT_INDEX(p[0], p[1], p[2])].id = AIR;
+		}
+	}
+}
+
+/*
+ * pushes face t of the box from p to p+size. Indexed quads are six indices
+ * into the vertex table, packed ones their first four corners.
+ */
+static inline void
+emit_quad(chunk_mesh_normal_index_t *elements, long *num, enum chunk_vertex_format format, int t, const int *p, const int *size, blockid_t id)
+{
+	int corners = format == CHUNK_VERTEX_PACKED ? 4 : 6;
+	int q;
+	for(q=t*18; q<t*18+corners*3; q+=3)
+	{
+		int x_ = p[0] + faces[q]*size[0];
+		int y_ = p[1] + faces[q+1]*size[1];
+		int z_ = p[2] + faces[q+2]*size[2];
+
+		chunk_mesh_normal_index_t index;
+		if(format == CHUNK_VERTEX_PACKED)
+			index = PACKED_VERTEX(x_, y_, z_, t, id);
+		else
+			index = x_ + y_*(CHUNKSIZE+1) + z_*(CHUNKSIZE+1)*(CHUNKSIZE+1) + id * (CHUNKSIZE+1)*(CHUNKSIZE+1)*(CHUNKSIZE+1);
+		elements[(*num)++] = index;
+	}
+}
+
+/*
+ * merges visible faces of the same block and water level in each layer into
+ * rectangles, growing along u first and then along v. Quads span more than
+ * one block, so they are drawn from the vertex table without wobble.
+ */
+static void
+mesh_greedy(const block_t *snapshot, const uint32_t *rows, enum chunk_vertex_format format, chunk_mesh_normal_index_t *elements, long *num)
+{
+	uint32_t mask[CHUNKSIZE*CHUNKSIZE]; //id and water level of the visible face, 0 for none
+
+	int t;
+	for(t=0; t<6; ++t)
+	{
+		int n = face_axis[t];
+		int u = (n+1)%3;
+		int v = (n+2)%3;
+
+		int layer;
+		for(layer=0; layer<CHUNKSIZE; ++layer)
+		{
+			int p[3];
+			p[n] = layer;
+			for(p[v]=0; p[v]<CHUNKSIZE; ++p[v])
+			for(p[u]=0; p[u]<CHUNKSIZE; ++p[u])
+			{
+				uint32_t key = 0;
+				if((rows[SOLID_ROW(p[1], p[2])] >> p[0]) & 1)
+				{
+					block_t block = snapshot[SNAPSHOT_INDEX(p[0], p[1], p[2])];
+					if(!face_hidden(block, snapshot[SNAPSHOT_INDEX(p[0], p[1], p[2]) + face_offset[t]], t))
+						key = block.id | (uint32_t)block.metadata.number << 16;
+				}
+				mask[p[u] + p[v]*CHUNKSIZE] = key;
+			}
+
+			int i, j;
+			for(j=0; j<CHUNKSIZE; ++j)
+			for(i=0; i<CHUNKSIZE; )
+			{
+				uint32_t key = mask[i + j*CHUNKSIZE];
+				if(!key)
+				{
+					++i;
+					continue;
+				}
+
+				int w = 1;
+				while(i+w < CHUNKSIZE && mask[i+w + j*CHUNKSIZE] == key)
+					++w;
+
+				int h = 1;
+				while(j+h < CHUNKSIZE)
+				{
+					int k;
+					for(k=0; k<w; ++k)
+						if(mask[i+k + (j+h)*CHUNKSIZE] != key)
+							break;
+					if(k < w)
+						break;
+					++h;
+				}
+
+				int k, l;
+				for(l=0; l<h; ++l)
+				for(k=0; k<w; ++k)
+					mask[i+k + (j+l)*CHUNKSIZE] = 0;
+
+				int size[3];
+				size[n] = 1;
+				size[u] = w;
+				size[v] = h;
+				p[u] = i;
+				p[v] = j;
+
+				//the unit face scaled up to the rectangle keeps its winding
+				emit_quad(elements, num, format, t, p, size, key & 0xffff);
+
+				i += w;
+			}
+		}
+	}
+}
+
+/*
+ * one quad for every visible face, in z slabs so partial remeshes can
+ * replace some of them
+ */
+static void
+mesh_faces(const block_t *snapshot, const uint32_t *rows, int zlow, int zhigh, int shell, enum chunk_vertex_format format, chunk_mesh_normal_index_t *elements, long *num, long *slabs)
+{
 	int x, y, z;
+	for(z=zlow; z<zhigh; ++z)
+	{
+		slabs[z] = *num;
+		for(y=0; y<CHUNKSIZE; ++y)
+		{
+			//only solid blocks have faces, inside a uniform chunk only those on its border
+			uint32_t row = rows[SOLID_ROW(y, z)];
+			if(shell && y > 0 && y < CHUNKSIZE-1 && z > 0 && z < CHUNKSIZE-1)
+				row &= 1 | (uint32_t)1 << (CHUNKSIZE-1);
+
+			while(row)
+			{
+				x = __builtin_ctz(row);
+				row &= row - 1;
+
+				const block_t *here = &snapshot[SNAPSHOT_INDEX(x, y, z)];
+				int p[3] = {x, y, z};
+				static const int unit[3] = {1, 1, 1};
+				int t;
+
+				for(t=0; t<6; ++t)
+					if(!face_hidden(*here, here[face_offset[t]], t))
+						emit_quad(elements, num, format, t, p, unit, here->id);
+			}
+		}
+	}
+}
+
+/*
+ * row y, z of the snapshot as solid and fluid bits, x from -1 to CHUNKSIZE
+ * at bits 0 to CHUNKSIZE+1. Rows inside the chunk come from its bitsets,
+ * only padding rows are read block by block.
+ */
+static inline void
+binary_row(const block_t *snapshot, const uint32_t *rows, const uint32_t *fluidrows, int y, int z, uint64_t *solid, uint64_t *fluid)
+{
+	if(y >= 0 && y < CHUNKSIZE && z >= 0 && z < CHUNKSIZE)
+	{
+		blockid_t west = snapshot[SNAPSHOT_INDEX(-1, y, z)].id;
+		blockid_t east = snapshot[SNAPSHOT_INDEX(CHUNKSIZE, y, z)].id;
+		*solid = (uint64_t)rows[SOLID_ROW(y, z)] << 1 | (west != AIR) | (uint64_t)(east != AIR) << (CHUNKSIZE+1);
+		*fluid = (uint64_t)fluidrows[SOLID_ROW(y, z)] << 1 | BLOCK_PROPERTY_FLUID(west) | (uint64_t)BLOCK_PROPERTY_FLUID(east) << (CHUNKSIZE+1);
+		return;
+	}
+
+	*solid = 0;
+	*fluid = 0;
+	int x;
 	for(x=0; x<CHUNKSIZE; ++x)
 	{
+		blockid_t id = snapshot[SNAPSHOT_INDEX(x, y, z)].id;
+		*solid |= (uint64_t)(id != AIR) << (x+1);
+		*fluid |= (uint64_t)BLOCK_PROPERTY_FLUID(id) << (x+1);
+	}
+}
+
+/*
+ * faces of a row towards the neighbouring row in direction t. Opaque blocks
+ * hide them and fluids never hide other blocks, so only fluids next to
+ * fluids look their faces up in the cull table one by one.
+ */
+static inline uint32_t
+binary_side(const block_t *snapshot, uint32_t fluid, uint32_t neighbour, uint32_t neighbourfluid, int y, int z, int t)
+{
+	uint32_t shown = 0;
+	uint32_t both = fluid & neighbourfluid;
+	while(both)
+	{
+		int x = __builtin_ctz(both);
+		both &= both - 1;
+		const block_t *here = &snapshot[SNAPSHOT_INDEX(x, y, z)];
+		if(!face_hidden(*here, here[face_offset[t]], t))
+			shown |= (uint32_t)1 << x;
+	}
+
+	return ~neighbour | (neighbourfluid & ~fluid) | shown;
+}
+
+/*
+ * the same quads as mesh_faces in the same order, but the visible faces of
+ * a whole row are found at once by masking its solid bits with the
+ * neighbouring rows. Only blocks with a visible face are read.
+ */
+static void
+mesh_binary(const block_t *snapshot, const uint32_t *rows, const uint32_t *fluidrows, int zlow, int zhigh, enum chunk_vertex_format format, chunk_mesh_normal_index_t *elements, long *num, long *slabs)
+{
+	int y, z;
+	for(z=zlow; z<zhigh; ++z)
+	{
+		slabs[z] = *num;
 		for(y=0; y<CHUNKSIZE; ++y)
 		{
-			for(z=0; z<CHUNKSIZE; ++z)
+			uint32_t solid = rows[SOLID_ROW(y, z)];
+			if(!solid)
+				continue;
+			uint32_t fluid = fluidrows[SOLID_ROW(y, z)];
+
+			uint64_t here, herefluid, above, abovefluid, below, belowfluid;
+			uint64_t south, southfluid, north, northfluid;
+			binary_row(snapshot, rows, fluidrows, y, z, &here, &herefluid);
+			binary_row(snapshot, rows, fluidrows, y+1, z, &above, &abovefluid);
+			binary_row(snapshot, rows, fluidrows, y-1, z, &below, &belowfluid);
+			binary_row(snapshot, rows, fluidrows, y, z+1, &south, &southfluid);
+			binary_row(snapshot, rows, fluidrows, y, z-1, &north, &northfluid);
+
+			//a covered fluid may still show its top, that is up to the cull table
+			uint32_t shallow = 0;
+			uint32_t bits = fluid & (uint32_t)(above >> 1);
+			while(bits)
+			{
+				int x = __builtin_ctz(bits);
+				bits &= bits - 1;
+				const block_t *block = &snapshot[SNAPSHOT_INDEX(x, y, z)];
+				if(!face_hidden(*block, block[face_offset[BLOCK_FACE_UP]], BLOCK_FACE_UP))
+					shallow |= (uint32_t)1 << x;
+			}
+
+			uint32_t U[6] = {
+				solid & (~(uint32_t)(above >> 1) | shallow),
+				solid & ~(uint32_t)(below >> 1),
+				solid & binary_side(snapshot, fluid, south >> 1, southfluid >> 1, y, z, BLOCK_FACE_SOUTH),
+				solid & binary_side(snapshot, fluid, north >> 1, northfluid >> 1, y, z, BLOCK_FACE_NORTH),
+				solid & binary_side(snapshot, fluid, here >> 2, herefluid >> 2, y, z, BLOCK_FACE_EAST),
+				solid & binary_side(snapshot, fluid, here, herefluid, y, z, BLOCK_FACE_WEST)
+			};
+
+			uint32_t visible = U[0] | U[1] | U[2] | U[3] | U[4] | U[5];
+			while(visible)
+			{
+				int x = __builtin_ctz(visible);
+				visible &= visible - 1;
+
+				blockid_t id = snapshot[SNAPSHOT_INDEX(x, y, z)].id;
+				int p[3] = {x, y, z};
+				static const int unit[3] = {1, 1, 1};
+				int t;
+				for(t=0; t<6; ++t)
+					if((U[t] >> x) & 1)
+						emit_quad(elements, num, format, t, p, unit, id);
+			}
+		}
+	}
+}
+
+/*
+ * meshes cells of 2^lod blocks, a cell is drawn as its topmost block when at
+ * least half of it is not air. Border cells are air if any block of the
+ * neighbours layer next to them is, so a coarser chunk never hides a hole
+ */
+static void
+mesh_lod(const block_t *snapshot, block_t *cells, int lod, enum chunk_vertex_format format, chunk_mesh_normal_index_t *elements, long *num, long *slabs)
+{
+	int size = 1 << lod;
+	int n = CHUNKSIZE >> lod;
+	int x, y, z, cx, cy, cz, t;
+	memset(cells, 0, (n+2)*(n+2)*(n+2) * sizeof(block_t));
+
+	for(cz=0; cz<n; ++cz)
+	for(cy=0; cy<n; ++cy)
+	for(cx=0; cx<n; ++cx)
+	{
+		block_t top = {AIR, {SIM_WATER_LEVELS}}; //cells count as full, fluid ones hide each other like blocks
+		int count = 0;
+		for(y=size-1; y>=0; --y)
+		for(z=0; z<size; ++z)
+		for(x=0; x<size; ++x)
+		{
+			block_t b = snapshot[SNAPSHOT_INDEX(cx*size + x, cy*size + y, cz*size + z)];
+			if(b.id == AIR)
+				continue;
+			if(top.id == AIR)
+				top.id = b.id;
+			count++;
+		}
+		if(count * 2 >= size*size*size)
+			cells[LOD_CELLS_INDEX(cx, cy, cz, n)] = top;
+	}
+
+	for(t=0; t<6; ++t)
+	{
+		int axis = face_axis[t];
+		int u, v;
+		for(u=0; u<n; ++u)
+		for(v=0; v<n; ++v)
+		{
+			block_t cell = {AIR, {SIM_WATER_LEVELS}};
+			int hasair = 0;
+			int p[3];
+			p[axis] = t % 2 ? -1 : CHUNKSIZE;
+			for(x=0; x<size; ++x)
+			for(y=0; y<size; ++y)
 			{
-				block_t block = get_block(chunk, x, y, z);
-				if(block.id != AIR)
+				p[(axis+1)%3] = u*size + x;
+				p[(axis+2)%3] = v*size + y;
+				cell.id = snapshot[SNAPSHOT_INDEX(p[0], p[1], p[2])].id;
+				hasair |= cell.id == AIR;
+			}
+
+			int c[3];
+			c[axis] = t % 2 ? -1 : n;
+			c[(axis+1)%3] = u;
+			c[(axis+2)%3] = v;
+			if(!hasair)
+				cells[LOD_CELLS_INDEX(c[0], c[1], c[2], n)] = cell;
+		}
+	}
+
+	const int cellsize[3] = {size, size, size};
+	for(cz=0; cz<n; ++cz)
+	{
+		for(z=cz*size; z<(cz+1)*size; ++z)
+			slabs[z] = *num;
+
+		for(cy=0; cy<n; ++cy)
+		for(cx=0; cx<n; ++cx)
+		{
+			block_t cell = cells[LOD_CELLS_INDEX(cx, cy, cz, n)];
+			if(cell.id == AIR)
+				continue;
+
+			int p[3] = {cx*size, cy*size, cz*size};
+			for(t=0; t<6; ++t)
+			{
+				block_t b = cells[LOD_CELLS_INDEX(cx + face_step[t][0], cy + face_step[t][1], cz + face_step[t][2], n)];
+				if(!face_hidden(cell, b, t))
+					emit_quad(elements, num, format, t, p, cellsize, cell.id);
+			}
+		}
+	}
+}
+
+/*
+ * the faces of section s after the slabs zlow to zhigh were remeshed into
+ * fresh, which is indexed like newslabs. to may be the old room itself
+ */
+static void
+section_splice(chunk_mesh_normal_index_t *to, const chunk_mesh_normal_index_t *old, const long *oldslabs, const long *newslabs, const chunk_mesh_normal_index_t *fresh, int s, int zlow, int zhigh)
+{
+	int first = s*MESH_SECTION_SLABS;
+	int last = first + MESH_SECTION_SLABS;
+	int low = imin(imax(zlow, first), last);
+	int high = imin(imax(zhigh, first), last);
+
+	//the slabs after the fresh ones move first, the fresh ones may go where they were
+	long n = oldslabs[last] - oldslabs[high];
+	if(n > 0)
+		memmove(to + newslabs[high] - newslabs[first], old + oldslabs[high] - oldslabs[first], n * sizeof(chunk_mesh_normal_index_t));
+	n = newslabs[high] - newslabs[low];
+	if(n > 0)
+		memcpy(to + newslabs[low] - newslabs[first], fresh + newslabs[low], n * sizeof(chunk_mesh_normal_index_t));
+	n = oldslabs[low] - oldslabs[first];
+	if(n > 0 && to != old)
+		memcpy(to, old, n * sizeof(chunk_mesh_normal_index_t));
+}
+
+//grows the seed bits along the runs of open bits they are in, both ways at once
+static inline uint32_t
+row_span(uint32_t seed, uint32_t open)
+{
+	uint32_t up = seed;
+	uint32_t down = seed;
+	uint32_t upopen = open;
+	uint32_t downopen = open;
+	int shift;
+	for(shift=1; shift<CHUNKSIZE; shift*=2)
+	{
+		up |= upopen & up << shift;
+		upopen &= upopen << shift;
+		down |= downopen & down >> shift;
+		downopen &= downopen >> shift;
+	}
+	return up | down;
+}
+
+//the chunk faces the blocks in bits of row SOLID_ROW(y, z) lie on
+static inline int
+row_faces(int y, int z, uint32_t bits)
+{
+	int faces = 0;
+	if(y == CHUNKSIZE-1)
+		faces |= 1 << BLOCK_FACE_UP;
+	if(y == 0)
+		faces |= 1 << BLOCK_FACE_DOWN;
+	if(z == CHUNKSIZE-1)
+		faces |= 1 << BLOCK_FACE_SOUTH;
+	if(z == 0)
+		faces |= 1 << BLOCK_FACE_NORTH;
+	if(bits >> (CHUNKSIZE-1))
+		faces |= 1 << BLOCK_FACE_EAST;
+	if(bits & 1)
+		faces |= 1 << BLOCK_FACE_WEST;
+	return bits ? faces : 0;
+}
+
+/*
+ * sets bit f of visibility[t] when face t of the chunk reaches face f through
+ * blocks that don't hide what's behind them. Each region of them that touches
+ * the border is filled in turn, a row of bits at a time.
+ */
+static void
+visibility_build(const uint32_t *rows, const uint32_t *fluidrows, uint8_t *visibility)
+{
+	uint32_t open[CHUNKSIZE*CHUNKSIZE]; //not filled yet
+	uint32_t pending[CHUNKSIZE*CHUNKSIZE]; //filled but not spread to the next rows
+	uint16_t stack[CHUNKSIZE*CHUNKSIZE];
+	int r;
+
+	//fluids are solid, but can be seen through
+	for(r=0; r<CHUNKSIZE*CHUNKSIZE; ++r)
+		open[r] = ~rows[r] | fluidrows[r];
+	memset(pending, 0, sizeof(pending));
+	memset(visibility, 0, 6);
+
+	for(r=0; r<CHUNKSIZE*CHUNKSIZE; ++r)
+	{
+		int y = r % CHUNKSIZE;
+		int z = r / CHUNKSIZE;
+		uint32_t border = y == 0 || y == CHUNKSIZE-1 || z == 0 || z == CHUNKSIZE-1 ? ~0u : 1u | 1u << (CHUNKSIZE-1);
+
+		while(open[r] & border)
+		{
+			uint32_t seed = open[r] & border;
+			seed &= -seed;
+
+			int num = 0;
+			int faces = 0;
+			pending[r] = row_span(seed, open[r]);
+			open[r] &= ~pending[r];
+			stack[num++] = r;
+
+			while(num)
+			{
+				int row = stack[--num];
+				uint32_t spread = pending[row];
+				pending[row] = 0;
+
+				int rowy = row % CHUNKSIZE;
+				int rowz = row / CHUNKSIZE;
+				faces |= row_faces(rowy, rowz, spread);
+
+				int next[4] = {
+					rowy < CHUNKSIZE-1 ? row + 1 : -1,
+					rowy > 0 ? row - 1 : -1,
+					rowz < CHUNKSIZE-1 ? row + CHUNKSIZE : -1,
+					rowz > 0 ? row - CHUNKSIZE : -1
+				};
+				int i;
+				for(i=0; i<4; ++i)
 				{
-					int top, bottom, south, north, east, west;
+					int n = next[i];
+					if(n < 0 || !(spread & open[n]))
+						continue;
+
+					uint32_t bits = row_span(spread & open[n], open[n]);
+					open[n] &= ~bits;
+					if(!pending[n])
+						stack[num++] = n;
+					pending[n] |= bits;
+				}
+			}
 
-					if(y==CHUNKSIZE-1)
-					{
-						if(chunkabove)
-						{
-							block_t b = get_block(chunkabove, x,0,z);
-							if(b.id != AIR && (block.id != WATER || block.metadata.number == SIM_WATER_LEVELS))
-								top=0;
-							else
-								top=1;
-						} else
-							top=1;
-					} else {
-						if(get_block(chunk, x,y+1,z).id && (block.id != WATER || block.metadata.number == SIM_WATER_LEVELS))
-							top = 0;
-						else
-							top = 1;
-					}
-					if(y==0)
-					{
-						if(chunkbelow)
-						{
-							if(get_block(chunkbelow, x,CHUNKSIZE-1,z).id)
-								bottom=0;
-							else
-								bottom=1;
-						} else
-							bottom=1;
-					} else {
-						if(get_block(chunk, x,y-1,z).id)
-							bottom = 0;
-						else
-							bottom = 1;
-					}
-					if(z==CHUNKSIZE-1)
-					{
-						if(chunksouth)
-						{
-							block_t b = get_block(chunksouth, x,y,0);
-							if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-								south=0;
-							else
-								south=1;
-						} else
-							south=1;
-					} else {
-						block_t b = get_block(chunk, x,y,z+1);
-						if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-							south = 0;
-						else
-							south = 1;
-					}
-					if(z==0)
-					{
-						if(chunknorth)
-						{
-							block_t b = get_block(chunknorth, x,y,CHUNKSIZE-1);
-							if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-								north=0;
-							else
-								north=1;
-						} else
-							north=1;
-					} else {
-						block_t b = get_block(chunk, x,y,z-1);
-						if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-							north = 0;
-						else
-							north = 1;
-					}
+			int t;
+			for(t=0; t<6; ++t)
+				if(faces & 1 << t)
+					visibility[t] |= faces;
+		}
+	}
+}
 
-					if(x==CHUNKSIZE-1)
-					{
-						if(chunkeast)
-						{
-							block_t b = get_block(chunkeast, 0,y,z);
-							if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-								east=0;
-							else
-								east=1;
-						} else
-							east=1;
-					} else {
-						block_t b = get_block(chunk, x+1,y,z);
-						if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-							east = 0;
-						else
-							east = 1;
-					}
-					if(x==0)
-					{
-						if(chunkwest)
-						{
-							block_t b = get_block(chunkwest, CHUNKSIZE-1,y,z);
-							if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-								west=0;
-							else
-								west=1;
-						} else
-							west=1;
-					} else {
-						block_t b = get_block(chunk, x-1,y,z);
-						if(b.id != AIR && (b.id != WATER || (block.id == WATER && b.metadata.number == block.metadata.number)))
-							west = 0;
-						else
-							west = 1;
-					}
+chunk_mesh_scratch_t *
+chunk_mesh_scratch_create()
+{
+	return malloc(sizeof(chunk_mesh_scratch_t));
+}
 
-					int U[6] = {
-						top,
-						bottom,
-						south,
-						north,
-						east,
-						west
-					};
-					int q=0;
-					int t;
-
-					for(t=0; t<6; ++t)
-					{
-						if(U[t])
-						{
-							int Q=q+18;
-							while(q<Q)
-							{
-								int x_ = faces[q++] + x;
-								int y_ = faces[q++] + y;
-								int z_ = faces[q++] + z;
+void
+chunk_mesh_scratch_destroy(chunk_mesh_scratch_t *scratch)
+{
+	free(scratch);
+}
+
+void
+chunk_remesh(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest, chunk_mesh_scratch_t *scratch)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	enum chunk_mesher mode = mesher;
+	enum chunk_vertex_format format = vertexformat;
+
+	chunk_lock(chunk);
+
+	//only the z slabs next to changed blocks are rebuilt, the others are kept from the last mesh
+	lock_write(chunk);
+	int zlow = imax(chunk->dirtylow.z - 1, 0);
+	int zhigh = imin(chunk->dirtyhigh.z + 1, CHUNKSIZE);
+	clear_dirty(chunk);
+	Uint64 instantedit = chunk->instantedit;
+	chunk->instantedit = 0;
+	int lod = chunk->lod;
+
+	//greedy and lod quads cross slabs, and slabs of another format can't be kept
+	if(zlow < zhigh && (mode == CHUNK_MESHER_GREEDY || lod > 0 || chunk->mesh.flat || format != chunk->mesh.format))
+	{
+		zlow = 0;
+		zhigh = CHUNKSIZE;
+	}
+	//edits after this point clear it again and get picked up by the next remesh
+	chunk->iscurrent = 1;
+
+	//a uniform chunk has no faces inside, only its border can show any
+	block_t uniform;
+	int isuniform = is_uniform(chunk, &uniform);
+	int empty = isuniform && uniform.id == AIR;
+	int shell = isuniform && (uniform.id != WATER || uniform.metadata.number == SIM_WATER_LEVELS);
+	unlock_write(chunk);
+
+	if(empty)
+	{
+		zlow = 0;
+		zhigh = CHUNKSIZE;
+	}
 
-								//Add point to vbo
-								chunk_mesh_normal_index_t index = x_ + y_*(CHUNKSIZE+1) + z_*(CHUNKSIZE+1)*(CHUNKSIZE+1) + block.id * (CHUNKSIZE+1)*(CHUNKSIZE+1)*(CHUNKSIZE+1);
-								stack_push(elements, &index);
-							}
-						} else {
-							q+=18;
-						}
-					}
-				}
-			}
-		}
+	if(zlow >= zhigh)
+	{
+		chunk_unlock(chunk);
+		return;
 	}
 
-	if(chunkabove)
-		unlock_read(chunkabove);
-	if(chunkbelow)
-		unlock_read(chunkbelow);
-	if(chunknorth)
-		unlock_read(chunknorth);
-	if(chunksouth)
-		unlock_read(chunksouth);
-	if(chunkeast)
-		unlock_read(chunkeast);
-	if(chunkwest)
-		unlock_read(chunkwest);
+	//threads without their own scratch borrow one for this remesh
+	chunk_mesh_scratch_t *borrowed = 0;
+	if(!scratch)
+		scratch = borrowed = chunk_mesh_scratch_create();
 
-	unlock_read(chunk);
+	block_t *snapshot = scratch->snapshot;
+	chunk_mesh_normal_index_t *elements = scratch->elements;
+	uint32_t rows[CHUNKSIZE*CHUNKSIZE];
+	uint32_t fluidrows[CHUNKSIZE*CHUNKSIZE];
+	if(!empty)
+	{
+		snapshot_build(snapshot, rows, fluidrows, imax(zlow - 1, 0), imin(zhigh + 1, CHUNKSIZE), chunk, chunkabove, chunkbelow, chunknorth, chunksouth, chunkeast, chunkwest);
+
+		//faces toward the air cells of a coarse neighbour always show
+		chunk_t *neighbours[6] = {chunkabove, chunkbelow, chunksouth, chunknorth, chunkeast, chunkwest};
+		int t;
+		for(t=0; t<6; ++t)
+			if(neighbours[t] && neighbours[t]->lod > 0)
+				snapshot_clear_cells(snapshot, scratch->border, neighbours[t], t);
+	}
 
+	//an empty chunk connects all its faces
+	uint8_t visibility[6];
+	if(empty)
+		memset(visibility, (1 << 6) - 1, sizeof(visibility));
+	else
+		visibility_build(rows, fluidrows, visibility);
 
-	lock_write(chunk);
+	long fresh = 0;
+	long slabs[CHUNKSIZE+1];
+	int z;
 
-	if(chunk->mesh.uploadnext)
-		free(chunk->mesh.elements);
+	if(empty)
+	{
+		for(z=zlow; z<zhigh; ++z)
+			slabs[z] = 0;
+	} else if(lod > 0) {
+		mesh_lod(snapshot, scratch->cells, lod, format, elements, &fresh, slabs);
+	} else if(mode == CHUNK_MESHER_GREEDY) {
+		mesh_greedy(snapshot, rows, format, elements, &fresh);
+		for(z=zlow; z<zhigh; ++z)
+			slabs[z] = 0;
+	} else if(mode == CHUNK_MESHER_BINARY) {
+		mesh_binary(snapshot, rows, fluidrows, zlow, zhigh, format, elements, &fresh, slabs);
+	} else {
+		mesh_faces(snapshot, rows, zlow, zhigh, shell, format, elements, &fresh, slabs);
+	}
 
-	chunk->iscurrent = 1;
+	slabs[zhigh] = fresh;
+
+	//only chunk_remesh replaces the kept mesh, and it holds the chunk lock
+	long before = chunk->mesh.slabs[zlow];
+	long shift = before + fresh - chunk->mesh.slabs[zhigh];
+	long newslabs[CHUNKSIZE+1];
+	for(z=0; z<=CHUNKSIZE; ++z)
+		newslabs[z] = z < zlow ? chunk->mesh.slabs[z] : z <= zhigh ? before + slabs[z] : chunk->mesh.slabs[z] + shift;
+	long points = newslabs[CHUNKSIZE];
+
+	//the sections keep their room while their faces fit, else all of them get new rooms
+	int slow = zlow / MESH_SECTION_SLABS;
+	int shigh = (zhigh + MESH_SECTION_SLABS - 1) / MESH_SECTION_SLABS;
+	int s;
+	int relayout = zlow == 0 && zhigh == CHUNKSIZE;
+	for(s=slow; s<shigh; ++s)
+		if(newslabs[(s+1)*MESH_SECTION_SLABS] - newslabs[s*MESH_SECTION_SLABS] > chunk->mesh.sections[s+1] - chunk->mesh.sections[s])
+			relayout = 1;
+
+	chunk_mesh_normal_index_t *mesh = 0;
+	long sections[MESH_SECTIONS+1];
+	sections[0] = 0;
+	if(relayout)
+	{
+		//without room the packed quads still fit the shared indices
+		int room = points + points/4 + MESH_SECTIONS*23 <= MESH_QUADS_MAX*4;
+		for(s=0; s<MESH_SECTIONS; ++s)
+		{
+			long n = newslabs[(s+1)*MESH_SECTION_SLABS] - newslabs[s*MESH_SECTION_SLABS];
+			sections[s+1] = sections[s] + (room ? MESH_SECTION_ROOM(n) : n);
+		}
 
-	long points = stack_objects_get_num(elements);
+		if(sections[MESH_SECTIONS] > 0)
+			mesh = calloc(sections[MESH_SECTIONS], sizeof(chunk_mesh_normal_index_t));
+		for(s=0; s<MESH_SECTIONS; ++s)
+			section_splice(mesh + sections[s], chunk->mesh.elements + chunk->mesh.sections[s], chunk->mesh.slabs, newslabs, elements - before, s, zlow, zhigh);
+	}
 
-	chunk->mesh.points = points;
+	lock_write(chunk);
 
-	if(points > 0)
+	if(relayout)
 	{
-		stack_trim(elements);
-		chunk->mesh.elements = stack_transform_dataptr(elements);
+		free(chunk->mesh.elements);
+		chunk->mesh.elements = mesh;
+		memcpy(chunk->mesh.sections, sections, sizeof(sections));
+		chunk->mesh.size = sections[MESH_SECTIONS];
+		chunk->mesh.changedsections = (1 << MESH_SECTIONS) - 1;
 	} else {
-		chunk->mesh.elements = 0;
-		stack_destroy(elements);
+		//in place, the zeros after the faces draw nothing
+		for(s=slow; s<shigh; ++s)
+		{
+			chunk_mesh_normal_index_t *section = chunk->mesh.elements + chunk->mesh.sections[s];
+			long n = newslabs[(s+1)*MESH_SECTION_SLABS] - newslabs[s*MESH_SECTION_SLABS];
+			section_splice(section, section, chunk->mesh.slabs, newslabs, elements - before, s, zlow, zhigh);
+			memset(section + n, 0, (chunk->mesh.sections[s+1] - chunk->mesh.sections[s] - n) * sizeof(chunk_mesh_normal_index_t));
+			chunk->mesh.changedsections |= 1 << s;
+		}
 	}
 
+	memcpy(chunk->visibility, visibility, sizeof(visibility));
+	chunk->mesh.points = points;
+	chunk->mesh.flat = mode == CHUNK_MESHER_GREEDY || lod > 0;
+	chunk->mesh.format = format;
+	if(instantedit && !chunk->mesh.instantedit)
+		chunk->mesh.instantedit = instantedit;
+	memcpy(chunk->mesh.slabs, newslabs, sizeof(newslabs));
+
 	chunk->mesh.uploadnext = 1;
 
 	unlock_write(chunk);
 	chunk_unlock(chunk);
+
+	chunk_mesh_scratch_destroy(borrowed);
+
+	SDL_AtomicIncRef(&remeshcount);
+	SDL_AtomicAdd(&remeshus, (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+void
+chunk_mesher_set(enum chunk_mesher m)
+{
+	mesher = m;
+}
+
+enum chunk_mesher
+chunk_mesher_get()
+{
+	return mesher;
+}
+
+void
+chunk_vertex_format_set(enum chunk_vertex_format f)
+{
+	vertexformat = f;
+}
+
+enum chunk_vertex_format
+chunk_vertex_format_get()
+{
+	return vertexformat;
+}
+
+long
+chunk_remesh_stats_get(long *us)
+{
+	*us = SDL_AtomicSet(&remeshus, 0);
+	return SDL_AtomicSet(&remeshcount, 0);
+}
+
+long
+chunk_edit_latency_get(long *us, long *maxus)
+{
+	*us = SDL_AtomicSet(&editus, 0);
+	*maxus = SDL_AtomicSet(&editmaxus, 0);
+	return SDL_AtomicSet(&editcount, 0);
 }
 
 void
@@ -606,16 +1776,85 @@ chunk_mesh_is_current(chunk_t *chunk)
 void
 chunk_mesh_clear_current(chunk_t *chunk)
 {
+	lock_write(chunk);
+	mark_all_dirty(chunk);
 	chunk->iscurrent = 0;
+	unlock_write(chunk);
 }
 
 void
-chunk_mesh_clear(chunk_t *chunk)
+chunk_mesh_clear_box(chunk_t *chunk, int3_t low, int3_t high, int instant)
+{
+	lock_write(chunk);
+	if(instant && !chunk->instantedit)
+		chunk->instantedit = SDL_GetPerformanceCounter();
+	mark_dirty(chunk, low, high);
+	chunk->iscurrent = 0;
+	unlock_write(chunk);
+}
+
+int
+chunk_lod_set(chunk_t *chunk, int lod)
+{
+	lod = imin(imax(lod, 0), CHUNK_LOD_MAX);
+	if(chunk->lod == lod)
+		return 0;
+
+	lock_write(chunk);
+	chunk->lod = lod;
+	mark_all_dirty(chunk);
+	chunk->iscurrent = 0;
+	unlock_write(chunk);
+	return 1;
+}
+
+int
+chunk_lod_get(chunk_t *chunk)
+{
+	return chunk->lod;
+}
+
+int
+chunk_visibility_get(chunk_t *chunk, enum block_face face)
+{
+	return chunk->visibility[face];
+}
+
+//drops the mesh and its layout, the caller holds the write lock
+static void
+mesh_clear(chunk_t *chunk)
 {
 	chunk->mesh.points = 0;
+	chunk->mesh.size = 0;
+	chunk->mesh.uploadedpoints = 0;
+	chunk->mesh.uploadedsize = 0;
+	chunk->mesh.instantedit = 0;
+	chunk->instantedit = 0;
+	memset(chunk->mesh.slabs, 0, sizeof(chunk->mesh.slabs));
+	memset(chunk->mesh.sections, 0, sizeof(chunk->mesh.sections));
+	//an upload pending from the old layout would read the cleared sections
+	chunk->mesh.uploadnext = 0;
+	chunk->mesh.changedsections = 0;
+	//the faces of the new contents are unknown until the next remesh
+	memset(chunk->visibility, (1 << 6) - 1, sizeof(chunk->visibility));
+	mark_all_dirty(chunk);
 	chunk->iscurrent = 0;
 }
 
+void
+chunk_mesh_clear(chunk_t *chunk)
+{
+	lock_write(chunk);
+	mesh_clear(chunk);
+	unlock_write(chunk);
+}
+
+int
+chunk_modified_get(chunk_t *chunk)
+{
+	return chunk->modified;
+}
+
 block_t
 chunk_block_get(chunk_t *c, int x, int y, int z)
 {
@@ -632,6 +1871,10 @@ chunk_block_get(chunk_t *c, int x, int y, int z)
 	ret = get_block(c, x, y, z);
 	unlock_read(c);
 
+	//an atomic on every read would contend more than the lock, so a sample of them is counted
+	if(((x + y*3 + z*5) & (CHUNK_READ_SAMPLE-1)) == 0)
+		SDL_AtomicAdd(&c->reads, CHUNK_READ_SAMPLE);
+
 	return ret;
 }
 
@@ -650,6 +1893,7 @@ chunk_block_set(chunk_t *c, int x, int y, int z, block_t b)
 	lock_write(c);
 		set_block(c, x, y, z, b);
 	unlock_write(c);
+	SDL_AtomicIncRef(&c->writes);
 }
 
 void
@@ -672,8 +1916,9 @@ chunk_update_queue(chunk_t *chunk, int x, int y, int z, int time, update_flags_t
 {
 	long3_t pos = world_get_worldpos_of_internalpos(&chunk->pos, x, y, z);
 	chunk_lock(chunk);
+	chunk->modified = 1; //pending updates are saved with the chunk
 	lock_read(chunk);
-	if(chunk->iscompressed)
+	if(chunk->storage != CHUNK_STORAGE_RAW)
 	{
 		unlock_read(chunk);
 		update_queue(chunk->updates, pos.x, pos.y, pos.z, time, flags);
@@ -703,9 +1948,16 @@ chunk_update_run(chunk_t *chunk)
 
 	if(chunk_trylock(chunk) == BLOCKS_SUCCESS)
 	{
-		if(chunk->iscompressed)
+		if(chunk->storage != CHUNK_STORAGE_RAW)
 		{
-			num += update_run(chunk->updates);
+			//queueing takes the chunk lock, so an empty queue stays empty
+			block_t uniform;
+			lock_read(chunk);
+			int idle = is_uniform(chunk, &uniform) && !chunk->updates->queue;
+			unlock_read(chunk);
+
+			if(!idle)
+				num += update_run(chunk->updates);
 		} else {
 
 			int x, y, z;
@@ -726,17 +1978,40 @@ chunk_update_run(chunk_t *chunk)
 					}
 		}
 
-		if(num > CHUNK_UNCOMPRESS && chunk->iscompressed)
-		{
-			lock_write(chunk);
-			uncompress_chunk(chunk);
-			unlock_write(chunk);
-		}
-		else if(num < CHUNK_RECOMPRESS && !chunk->iscompressed)
+		long reads = SDL_AtomicSet(&chunk->reads, 0);
+		long writes = SDL_AtomicSet(&chunk->writes, 0) + num;
+		chunk->readheat += reads - (chunk->readheat >> CHUNK_ACCESS_DECAY);
+		chunk->writeheat += writes - (chunk->writeheat >> CHUNK_ACCESS_DECAY);
+
+		//bursts move a chunk up right away, it only moves down once the average has cooled off
+		long activity = chunk_activity_get(chunk);
+		long peak = MAX(writes + reads / CHUNK_READ_WEIGHT, activity);
+
+		//only go raw while it fits the budget, or enforcing it would undo this every tick
+		int rawfits = chunk->storage == CHUNK_STORAGE_RAW ||
+			chunk_memory_uncompressed_get() - chunk->accounted + RAW_BYTES <= CHUNK_UNCOMPRESSED_BUDGET;
+
+		enum chunk_storage storage = chunk->storage;
+		if(peak > CHUNK_UNCOMPRESS && rawfits)
+			storage = CHUNK_STORAGE_RAW;
+		else if(activity < CHUNK_RECOMPRESS && storage == CHUNK_STORAGE_RAW)
+			storage = CHUNK_STORAGE_PALETTE;
+		else if(peak >= CHUNK_PALETTE && storage == CHUNK_STORAGE_OCTREE)
+			storage = CHUNK_STORAGE_PALETTE;
+		else if(activity < CHUNK_PALETTE_LEAVE && storage == CHUNK_STORAGE_PALETTE)
+			storage = CHUNK_STORAGE_OCTREE;
+
+		if(storage != chunk->storage)
 		{
+			//a burst counts as sustained until it decays, so it does not flip straight back
+			if(storage > chunk->storage)
+				chunk->writeheat = MAX(chunk->writeheat, (uint32_t)peak << CHUNK_ACCESS_DECAY);
+
 			lock_write(chunk);
-			compress_chunk(chunk);
+			convert_chunk(chunk, storage);
 			unlock_write(chunk);
+		} else if(storage != CHUNK_STORAGE_OCTREE) {
+			account(chunk); //palettes and raw metadata grow as blocks are set
 		}
 
 		chunk_unlock(chunk);
@@ -747,6 +2022,49 @@ chunk_update_run(chunk_t *chunk)
 	return num;
 }
 
+long
+chunk_activity_get(chunk_t *chunk)
+{
+	return (chunk->writeheat + chunk->readheat / CHUNK_READ_WEIGHT) >> CHUNK_ACCESS_DECAY;
+}
+
+size_t
+chunk_uncompressed_size_get(chunk_t *chunk)
+{
+	return chunk->accounted;
+}
+
+size_t
+chunk_memory_uncompressed_get()
+{
+	return SDL_AtomicGet(&uncompressedbytes);
+}
+
+size_t
+chunk_recompress(chunk_t *chunk)
+{
+	if(chunk_trylock(chunk) != BLOCKS_SUCCESS)
+		return 0;
+
+	size_t before = chunk->accounted;
+
+	lock_write(chunk);
+	if(chunk->storage == CHUNK_STORAGE_RAW)
+		convert_chunk(chunk, CHUNK_STORAGE_PALETTE);
+	else
+		convert_chunk(chunk, CHUNK_STORAGE_OCTREE);
+	unlock_write(chunk);
+
+	//cooled below what moves it back up, so the demotion holds until new accesses heat it again
+	uint32_t cap = (chunk->storage == CHUNK_STORAGE_PALETTE ? CHUNK_RECOMPRESS : CHUNK_PALETTE_LEAVE) << CHUNK_ACCESS_DECAY;
+	chunk->writeheat = MIN(chunk->writeheat, cap);
+	chunk->readheat = MIN(chunk->readheat, (cap - chunk->writeheat) * CHUNK_READ_WEIGHT);
+
+	chunk_unlock(chunk);
+
+	return before - chunk->accounted;
+}
+
 chunk_t *
 chunk_load_empty(long3_t pos)
 {
@@ -763,19 +2081,15 @@ chunk_load_empty(long3_t pos)
 void
 chunk_free(chunk_t *chunk)
 {
-	if(chunk->mesh.uploadnext)
-		free(chunk->mesh.elements);
+	free(chunk->mesh.elements);
 
-	if(!chunk->iscompressed)
-		compress_chunk(chunk);
+	drop_storage(chunk);
 	update_stack_destroy(chunk->updates);
 
 	if(chunk->mesh.element_buffer)
 		glDeleteBuffers(1, &(chunk->mesh.element_buffer));
 	octree_destroy(chunk->data);
 	SDL_DestroyMutex(chunk->externallock);
-	SDL_DestroyMutex(chunk->mutex_read);
-	SDL_DestroySemaphore(chunk->sem_write);
 	free(chunk);
 }
 
@@ -784,25 +2098,21 @@ chunk_recenter(chunk_t *chunk, long3_t *pos)
 {
 	lock_write(chunk);
 
-	if(!chunk->iscompressed)
-	{
-		chunk->iscompressed = 1;
-		free(chunk->rawblocks);
-		free(chunk->rawupdates);
-		numuncompressed--;
-	}
+	drop_storage(chunk);
 
-	if(chunk->mesh.uploadnext)
-	{
-		free(chunk->mesh.elements);
-		chunk->mesh.uploadnext = 0;
-	}
+	chunk->mesh.uploadnext = 0;
 
 	update_stack_clear(chunk->updates);
 
 	chunk->pos = *pos;
 	octree_zero(chunk->data);
+	memset(chunk->solid, 0, sizeof(chunk->solid));
+	memset(chunk->fluid, 0, sizeof(chunk->fluid));
+	memset(chunk->visibility, (1 << 6) - 1, sizeof(chunk->visibility));
+	mark_all_dirty(chunk);
 	chunk->iscurrent = 0;
+	chunk->modified = 0;
+	clear_heat(chunk);
 	unlock_write(chunk);
 	return 0;//never loads from disk
 }
@@ -811,8 +2121,174 @@ void
 chunk_fill_air(chunk_t *chunk)
 {
 	lock_write(chunk);
+	convert_chunk(chunk, CHUNK_STORAGE_OCTREE);
 	octree_zero(chunk->data);
+	memset(chunk->solid, 0, sizeof(chunk->solid));
+	memset(chunk->fluid, 0, sizeof(chunk->fluid));
+	mark_all_dirty(chunk);
+	chunk->modified = 1;
+	unlock_write(chunk);
+}
+
+void
+chunk_blocks_get_box(chunk_t *chunk, int3_t low, int3_t high, block_t *out, int stridey, int stridez)
+{
+	lock_read(chunk);
+	copy_box(chunk, low, high, out, stridey, stridez);
+	unlock_read(chunk);
+
+	SDL_AtomicAdd(&chunk->reads, (high.x - low.x) * (high.y - low.y) * (high.z - low.z));
+}
+
+int
+chunk_block_solid(chunk_t *c, int x, int y, int z)
+{
+	if(MIN(MIN(x,y),z) < 0 || MAX(MAX(x,y),z) >= CHUNKSIZE)
+		return 0;
+
+	//a single word, no storage to decode
+	return (c->solid[SOLID_ROW(y, z)] >> x) & 1;
+}
+
+void
+chunk_solid_get_box(chunk_t *chunk, int3_t low, int3_t high, uint8_t *out, int stridey, int stridez)
+{
+	int x, y, z;
+	for(z=low.z; z<high.z; ++z)
+	for(y=low.y; y<high.y; ++y)
+	{
+		uint32_t row = chunk->solid[SOLID_ROW(y, z)];
+		uint8_t *dst = out + (y - low.y)*stridey + (z - low.z)*stridez - low.x;
+		for(x=low.x; x<high.x; ++x)
+			dst[x] = (row >> x) & 1;
+	}
+}
+
+void
+chunk_fill_box(chunk_t *chunk, int3_t low, int3_t high, block_t b)
+{
+	octree_box_t box = {
+		{imax(low.x, 0), imax(low.y, 0), imax(low.z, 0)},
+		{imin(high.x, CHUNKSIZE), imin(high.y, CHUNKSIZE), imin(high.z, CHUNKSIZE)}
+	};
+	if(box.low.x >= box.high.x || box.low.y >= box.high.y || box.low.z >= box.high.z)
+		return;
+
+	SDL_AtomicIncRef(&chunk->writes);
+
+	lock_write(chunk);
+	if(chunk->storage == CHUNK_STORAGE_OCTREE)
+	{
+		mark_dirty(chunk, box.low, box.high);
+		chunk->modified = 1;
+		rows_fill_box(chunk, box.low, box.high, b.id);
+		octree_fill_box(chunk->data, &box, &b);
+	} else {
+		int x, y, z;
+		for(z=box.low.z; z<box.high.z; ++z)
+		for(y=box.low.y; y<box.high.y; ++y)
+		for(x=box.low.x; x<box.high.x; ++x)
+			set_block(chunk, x, y, z, b);
+	}
+	unlock_write(chunk);
+}
+
+void
+chunk_fill_dense(chunk_t *chunk, const block_t *blocks)
+{
+	lock_write(chunk);
+	if(chunk->storage == CHUNK_STORAGE_RAW)
+	{
+		free(chunk->rawids);
+		free(chunk->rawmetadata);
+		raw_from_dense(chunk, blocks);
+		account(chunk);
+	} else {
+		drop_storage(chunk);
+		octree_destroy(chunk->data);
+		chunk->data = octree_build_from_dense(blocks);
+	}
+
+	int i;
+	for(i=0; i<CHUNKSIZE*CHUNKSIZE; ++i)
+	{
+		uint32_t row = 0, fluidrow = 0;
+		int x;
+		for(x=0; x<CHUNKSIZE; ++x)
+		{
+			row |= (uint32_t)(BLOCK_PROPERTY_SOLID(blocks[i*CHUNKSIZE + x].id) != 0) << x;
+			fluidrow |= (uint32_t)BLOCK_PROPERTY_FLUID(blocks[i*CHUNKSIZE + x].id) << x;
+		}
+		chunk->solid[i] = row;
+		chunk->fluid[i] = fluidrow;
+	}
+
+	mark_all_dirty(chunk);
+	unlock_write(chunk);
+}
+
+/*
+ * chunks of a single block without pending updates are saved as a short
+ * uncompressed record. Its zero uncompressed size tells it apart from the
+ * deflated ones.
+ */
+static size_t
+dump_uniform(chunk_t *chunk, block_t block, unsigned char **data)
+{
+	unsigned char *record = malloc(UNIFORM_RECORD_SIZE);
+
+	save_write_uint64(record, 0);
+	memcpy(record + 8, "CHUNK.u001", 10);
+	save_write_int64(record + 18, chunk->pos.x);
+	save_write_int64(record + 26, chunk->pos.y);
+	save_write_int64(record + 34, chunk->pos.z);
+	save_write_uint16(record + 42, block.id);
+	save_write_uint32(record + 44, block.metadata.number);
+
+	*data = record;
+	return UNIFORM_RECORD_SIZE;
+}
+
+static int
+read_uniform(chunk_t *chunk, const unsigned char *data)
+{
+	if(strncmp((char *)data + 8, "CHUNK.u001", 10) != 0)
+	{
+		error("reading chunk wrong version");
+		return BLOCKS_ERROR;
+	}
+
+	block_t block;
+	block.id = save_read_uint16(data + 42);
+	block.metadata.number = save_read_uint32(data + 44);
+	if(block.id >= BLOCK_NUM_TYPES)
+	{
+		error("reading uniform chunk bad block id");
+		return BLOCKS_ERROR;
+	}
+	octree_box_t all = {{0, 0, 0}, {CHUNKSIZE, CHUNKSIZE, CHUNKSIZE}};
+
+	chunk_lock(chunk);
+	lock_write(chunk);
+
+	drop_storage(chunk);
+	update_stack_clear(chunk->updates);
+
+	chunk->pos.x = save_read_int64(data + 18);
+	chunk->pos.y = save_read_int64(data + 26);
+	chunk->pos.z = save_read_int64(data + 34);
+
+	octree_fill_box(chunk->data, &all, &block);
+	rows_fill_box(chunk, all.low, all.high, block.id);
+
+	mesh_clear(chunk);
+	clear_heat(chunk);
+	chunk->modified = 0;
+
 	unlock_write(chunk);
+	chunk_unlock(chunk);
+
+	return BLOCKS_SUCCESS;
 }
 
 size_t
@@ -827,20 +2303,31 @@ chunk_dump(chunk_t *chunk, unsigned char **data)
 	chunk_lock(chunk);
 
 	lock_write(chunk);
-	if(!chunk->iscompressed)
-		compress_chunk(chunk);
+	convert_chunk(chunk, CHUNK_STORAGE_OCTREE);
 	unlock_write(chunk);
 
 	lock_read(chunk);
 
-	octree_size = octree_dump(chunk->data, &octree_data);
+	block_t uniform;
+	if(is_uniform(chunk, &uniform) && !chunk->updates->queue)
+	{
+		chunk->modified = 0;
+		unlock_read(chunk);
+
+		size_t size = dump_uniform(chunk, uniform, data);
+		chunk_unlock(chunk);
+		return size;
+	}
+
+	octree_size = octree_dump_packed(chunk->data, &octree_data);
 	updates_size = update_dump(chunk->updates, &updates_data);
+	chunk->modified = 0; //writers wait for the read lock
 
 	unlock_read(chunk);
 
 	//TODO: constants
 	stack_t *stack = stack_create(1, 10000, 2.0);
-	stack_push_mult(stack, "CHUNK.v000", 10);
+	stack_push_mult(stack, "CHUNK.v001", 10);
 
 	unsigned char tmp[8];
 
@@ -864,9 +2351,6 @@ chunk_dump(chunk_t *chunk, unsigned char **data)
 
 	size_t size_uncompressed = stack_objects_get_num(stack);
 	unsigned char *data_uncompressed = stack_transform_dataptr(stack);
-	unsigned char *data_compressed = malloc(size_uncompressed + 8);
-
-
 
 	int zret;
 	z_stream zstrm;
@@ -877,17 +2361,23 @@ chunk_dump(chunk_t *chunk, unsigned char **data)
 	if(zret != Z_OK)
 		fail("chunk_dump(): zlib deflateInit() failed");
 
+	//small packed chunks can grow when deflated
+	size_t size_bound = deflateBound(&zstrm, size_uncompressed);
+	unsigned char *data_compressed = malloc(size_bound + 8);
+
 	zstrm.next_out = data_compressed + 8;
-	zstrm.avail_out = size_uncompressed;
+	zstrm.avail_out = size_bound;
 	zstrm.next_in = data_uncompressed;
 	zstrm.avail_in = size_uncompressed;
 	zret = deflate(&zstrm, Z_FINISH);
+	if(zret != Z_STREAM_END)
+		fail("chunk_dump(): zlib deflate() did not finish");
 
 	deflateEnd(&zstrm);
 
 	free(data_uncompressed);
 
-	size_t size_compressed = size_uncompressed - zstrm.avail_out;
+	size_t size_compressed = size_bound - zstrm.avail_out;
 	data_compressed = realloc(data_compressed, size_compressed + 8);
 	if(!data_compressed)
 		fail("chunk_dump(): realloc failed");
@@ -903,6 +2393,9 @@ chunk_dump(chunk_t *chunk, unsigned char **data)
 int
 chunk_read(chunk_t *chunk, const unsigned char *data)
 {
+	if(save_read_uint64(data) == 0)
+		return read_uniform(chunk, data);
+
 	size_t uncompressed_size = save_read_uint64(data);
 	unsigned char *uncompressed_data = malloc(uncompressed_size);
 
@@ -929,7 +2422,16 @@ chunk_read(chunk_t *chunk, const unsigned char *data)
 
 	data = uncompressed_data;
 
-	if(strncmp((char *)data, "CHUNK.v000", 10) != 0)
+	/*
+	 * v000: octree as tagged 7 byte leaves
+	 * v001: octree in the packed palette format
+	 */
+	int packed;
+	if(strncmp((char *)data, "CHUNK.v001", 10) == 0)
+		packed = 1;
+	else if(strncmp((char *)data, "CHUNK.v000", 10) == 0)
+		packed = 0;
+	else
 	{
 		error("reading chunk wrong version");
 		free(uncompressed_data);
@@ -939,8 +2441,7 @@ chunk_read(chunk_t *chunk, const unsigned char *data)
 	chunk_lock(chunk);
 	lock_write(chunk);
 
-	if(!chunk->iscompressed)
-		compress_chunk(chunk);
+	drop_storage(chunk);
 
 	octree_destroy(chunk->data);
 	update_stack_clear(chunk->updates);
@@ -960,11 +2461,14 @@ chunk_read(chunk_t *chunk, const unsigned char *data)
 	chunk->pos.z = save_read_int64(data);
 	data += 8;
 
-	chunk->data = octree_read(data);
+	chunk->data = packed ? octree_read_packed(data) : octree_read(data);
+	rows_from_octree(chunk);
 	data += octree_size;
 	update_read(chunk->updates, &chunk->pos, data, updates_size);
 
-	chunk_mesh_clear(chunk);
+	mesh_clear(chunk);
+	clear_heat(chunk);
+	chunk->modified = 0;
 
 	unlock_write(chunk);
 	free(uncompressed_data);
@@ -973,3 +2477,143 @@ chunk_read(chunk_t *chunk, const unsigned char *data)
 
 	return BLOCKS_SUCCESS;
 }
+
+struct lock_benchmark_s {
+	chunk_t *chunk;
+	SDL_atomic_t stop;
+	SDL_atomic_t reads;
+	SDL_atomic_t writes;
+};
+
+static int
+lock_benchmark_reader(void *ptr)
+{
+	struct lock_benchmark_s *bench = ptr;
+	int i = 0;
+	while(!SDL_AtomicGet(&bench->stop))
+	{
+		chunk_block_get(bench->chunk, i % CHUNKSIZE, (i / CHUNKSIZE) % CHUNKSIZE, (i / (CHUNKSIZE*CHUNKSIZE)) % CHUNKSIZE);
+		i++;
+	}
+	SDL_AtomicAdd(&bench->reads, i);
+	return 0;
+}
+
+static int
+lock_benchmark_writer(void *ptr)
+{
+	struct lock_benchmark_s *bench = ptr;
+	int i = 0;
+	while(!SDL_AtomicGet(&bench->stop))
+	{
+		chunk_block_set_id(bench->chunk, i % CHUNKSIZE, (i / CHUNKSIZE) % CHUNKSIZE, 0, i & 1 ? STONE : AIR);
+		i++;
+	}
+	SDL_AtomicAdd(&bench->writes, i);
+	return 0;
+}
+
+/*
+ * debug: hammers a scratch chunk with 4, 8 and 16 readers and a single
+ * writer for CHUNK_LOCK_BENCHMARK_MS each and logs the throughput
+ */
+void
+chunk_lock_benchmark()
+{
+	static const int numreaders[] = {4, 8, 16};
+	long3_t pos = {0, 0, 0};
+
+	int n;
+	for(n=0; n<3; n++)
+	{
+		struct lock_benchmark_s bench;
+		bench.chunk = chunk_load_empty(pos);
+		SDL_AtomicSet(&bench.stop, 0);
+		SDL_AtomicSet(&bench.reads, 0);
+		SDL_AtomicSet(&bench.writes, 0);
+
+		SDL_Thread *threads[17];
+		int i;
+		for(i=0; i<numreaders[n]; i++)
+			threads[i] = SDL_CreateThread(lock_benchmark_reader, "chunk_lock_benchmark", &bench);
+		threads[i] = SDL_CreateThread(lock_benchmark_writer, "chunk_lock_benchmark", &bench);
+
+		SDL_Delay(CHUNK_LOCK_BENCHMARK_MS);
+		SDL_AtomicSet(&bench.stop, 1);
+		for(i=0; i<=numreaders[n]; i++)
+			SDL_WaitThread(threads[i], 0);
+
+		info("lock benchmark: %i readers %.2f Mreads/s, 1 writer %.2f Mwrites/s",
+				numreaders[n],
+				SDL_AtomicGet(&bench.reads) / (CHUNK_LOCK_BENCHMARK_MS * 1000.0),
+				SDL_AtomicGet(&bench.writes) / (CHUNK_LOCK_BENCHMARK_MS * 1000.0));
+
+		chunk_free(bench.chunk);
+	}
+}
+
+/*
+ * meshes a chunk with every mesher without touching its mesh, adding the
+ * microseconds spent meshing and the triangles of each mesher to us and
+ * triangles. Returns how many indices of the binary mesh differ from the
+ * face mesh, which should be none.
+ */
+long
+chunk_mesher_benchmark(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest, long *us, long *triangles)
+{
+	chunk_mesh_scratch_t *scratch = chunk_mesh_scratch_create();
+	uint32_t rows[CHUNKSIZE*CHUNKSIZE];
+	uint32_t fluidrows[CHUNKSIZE*CHUNKSIZE];
+	snapshot_build(scratch->snapshot, rows, fluidrows, 0, CHUNKSIZE, chunk, chunkabove, chunkbelow, chunknorth, chunksouth, chunkeast, chunkwest);
+
+	chunk_mesh_normal_index_t *faces = 0;
+	long numfaces = 0;
+	long slabs[CHUNKSIZE+1];
+	long mismatches = 0;
+
+	int m;
+	for(m=0; m<CHUNK_MESHER_NUM; ++m)
+	{
+		long num = 0;
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		int run;
+		for(run=0; run<CHUNK_MESHER_BENCHMARK_RUNS; ++run)
+		{
+			num = 0;
+			switch(m)
+			{
+				case CHUNK_MESHER_FACES:
+					mesh_faces(scratch->snapshot, rows, 0, CHUNKSIZE, 0, vertexformat, scratch->elements, &num, slabs);
+				break;
+				case CHUNK_MESHER_GREEDY:
+					mesh_greedy(scratch->snapshot, rows, vertexformat, scratch->elements, &num);
+				break;
+				case CHUNK_MESHER_BINARY:
+					mesh_binary(scratch->snapshot, rows, fluidrows, 0, CHUNKSIZE, vertexformat, scratch->elements, &num, slabs);
+				break;
+			}
+		}
+
+		us[m] += (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency() / CHUNK_MESHER_BENCHMARK_RUNS;
+		triangles[m] += (vertexformat == CHUNK_VERTEX_PACKED ? num / 4 * 6 : num) / 3;
+
+		if(m == CHUNK_MESHER_FACES)
+		{
+			numfaces = num;
+			faces = malloc(num * sizeof(chunk_mesh_normal_index_t) + 1);
+			memcpy(faces, scratch->elements, num * sizeof(chunk_mesh_normal_index_t));
+		} else if(m == CHUNK_MESHER_BINARY) {
+			mismatches = labs(numfaces - num);
+			long i;
+			for(i=0; i<MIN(numfaces, num); ++i)
+				if(faces[i] != scratch->elements[i])
+					mismatches++;
+		}
+	}
+
+	free(faces);
+	chunk_mesh_scratch_destroy(scratch);
+
+	return mismatches;
+}
@@ -1,6 +1,7 @@
 #ifndef CHUNK_H
 #define CHUNK_H
 
+#include <GL/glew.h>
 #include <stdlib.h>
 
 #include "defines.h"
@@ -12,6 +13,19 @@
 #define CHUNKSIZE (int) CAT(0x1p, CHUNK_LEVELS)
 
 typedef struct chunk chunk_t;
+typedef struct chunk_mesh_scratch chunk_mesh_scratch_t;
+
+#define CHUNK_MESHER_NUM 3
+enum chunk_mesher {
+	CHUNK_MESHER_FACES, //a quad per visible face
+	CHUNK_MESHER_GREEDY, //coplanar faces of a block merged into rectangles
+	CHUNK_MESHER_BINARY //the quads of FACES, found a row of bits at a time
+};
+
+enum chunk_vertex_format {
+	CHUNK_VERTEX_INDEXED, //indices into the shared vertex and colour tables
+	CHUNK_VERTEX_PACKED //32 bit vertices with position, face and block id, decoded by the shader
+};
 
 void chunk_static_init();
 void chunk_static_cleanup();
@@ -19,12 +33,23 @@ void chunk_static_cleanup();
 chunk_t *chunk_load_empty(long3_t pos);
 void chunk_free(chunk_t *chunk);
 void chunk_fill_air(chunk_t *chunk);
+void chunk_fill_box(chunk_t *chunk, int3_t low, int3_t high, block_t b);
+void chunk_fill_dense(chunk_t *chunk, const block_t *blocks);
 
 long3_t chunk_pos_get(chunk_t *chunk);
 int chunk_recenter(chunk_t *chunk, long3_t *pos);
 
-long chunk_render(chunk_t *chunk);
-void chunk_remesh(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest);
+void chunk_upload(chunk_t *chunk);//uploads a new mesh without drawing it
+long chunk_render(chunk_t *chunk, GLint packeduniform);
+chunk_mesh_scratch_t *chunk_mesh_scratch_create(); //one per meshing thread
+void chunk_mesh_scratch_destroy(chunk_mesh_scratch_t *scratch);
+void chunk_remesh(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest, chunk_mesh_scratch_t *scratch); //scratch may be 0
+void chunk_mesher_set(enum chunk_mesher m); //applies to remeshes from now on
+enum chunk_mesher chunk_mesher_get();
+void chunk_vertex_format_set(enum chunk_vertex_format f); //applies to remeshes from now on
+enum chunk_vertex_format chunk_vertex_format_get();
+long chunk_remesh_stats_get(long *us); //remeshes and microseconds spent since the last call
+long chunk_edit_latency_get(long *us, long *maxus); //instant edits uploaded since the last call, with their summed and longest time from edit to upload
 
 void chunk_lock(chunk_t *chunk);
 int chunk_trylock(chunk_t *chunk);
@@ -32,17 +57,35 @@ void chunk_unlock(chunk_t *chunk);
 
 int chunk_mesh_is_current(chunk_t *chunk);
 void chunk_mesh_clear_current(chunk_t *chunk);
-void chunk_mesh_clear(chunk_t *chunk);
+void chunk_mesh_clear_box(chunk_t *chunk, int3_t low, int3_t high, int instant); //only remeshes the slabs around the box, instant edits count towards chunk_edit_latency_get
+void chunk_mesh_clear(chunk_t *chunk); //drops the mesh, its slab layout and marks the whole chunk dirty
+int chunk_lod_set(chunk_t *chunk, int lod); //meshes in cells of 2^lod blocks, returns 1 when it changed and the neighbours need a remesh too
+int chunk_lod_get(chunk_t *chunk);
+int chunk_visibility_get(chunk_t *chunk, enum block_face face); //bit f is set when face f can be seen through the chunk from face, as of the last remesh
+int chunk_modified_get(chunk_t *chunk); //changed since it was loaded, generated or saved
 
 block_t chunk_block_get(chunk_t *c, int x, int y, int z);
 blockid_t chunk_block_get_id(chunk_t *c, int x, int y, int z);
+//low and high must lie inside the chunk. out points to the element for low
+void chunk_blocks_get_box(chunk_t *chunk, int3_t low, int3_t high, block_t *out, int stridey, int stridez);
+//solidity is kept in a bitset, these do not decode blocks
+int chunk_block_solid(chunk_t *c, int x, int y, int z);
+void chunk_solid_get_box(chunk_t *chunk, int3_t low, int3_t high, uint8_t *out, int stridey, int stridez);
 void chunk_block_set(chunk_t *c, int x, int y, int z, block_t b);
 void chunk_block_set_id(chunk_t *c, int x, int y, int z, blockid_t id);
 
 void chunk_update_queue(chunk_t *chunk, int x, int y, int z, int time, update_flags_t flags);
 long chunk_update_run(chunk_t *chunk);
 
+long chunk_activity_get(chunk_t *chunk); //decayed accesses per tick
+size_t chunk_uncompressed_size_get(chunk_t *chunk);
+size_t chunk_memory_uncompressed_get();
+size_t chunk_recompress(chunk_t *chunk); //one step towards the octree, returns bytes freed
+
 size_t chunk_dump(chunk_t *chunk, unsigned char **data);
 int chunk_read(chunk_t *chunk, const unsigned char *data);
 
+void chunk_lock_benchmark();
+long chunk_mesher_benchmark(chunk_t *chunk, chunk_t *chunkabove, chunk_t *chunkbelow, chunk_t *chunknorth, chunk_t *chunksouth, chunk_t *chunkeast, chunk_t *chunkwest, long *us, long *triangles);
+
 #endif
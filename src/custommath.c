@@ -199,3 +199,37 @@ getviewmatrix(vec3_t eye, vec3_t target, vec3_t up)
 	dotmat4mat4(&orientation, &orientation, &translation);
 	return orientation;
 }
+
+vec4_t *
+getfrustumplanes(vec4_t *out, mat4_t *vp)
+{
+	//each plane is the last row plus or minus one of the others
+	const float *m = vp->mat;
+	int i;
+	for(i=0; i<6; ++i)
+	{
+		int row = i / 2;
+		float sign = i % 2 ? -1 : 1;
+		out[i].x = m[3] + sign * m[row];
+		out[i].y = m[7] + sign * m[4 + row];
+		out[i].z = m[11] + sign * m[8 + row];
+		out[i].w = m[15] + sign * m[12 + row];
+	}
+	return out;
+}
+
+int
+boxinfrustum(vec4_t *planes, vec3_t low, vec3_t high)
+{
+	//only the corner furthest along each normal has to be inside
+	int i;
+	for(i=0; i<6; ++i)
+	{
+		float x = planes[i].x > 0 ? high.x : low.x;
+		float y = planes[i].y > 0 ? high.y : low.y;
+		float z = planes[i].z > 0 ? high.z : low.z;
+		if(planes[i].x*x + planes[i].y*y + planes[i].z*z + planes[i].w < 0)
+			return 0;
+	}
+	return 1;
+}
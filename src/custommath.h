@@ -83,4 +83,8 @@ mat4_t getrotmatrix(float rx, float ry, float rz);
 mat4_t getprojectionmatrix(float fov, float aspect, float far, float near);
 mat4_t getviewmatrix(vec3_t eye, vec3_t target, vec3_t up);//lookat right-handed
 
+//the planes of the frustum of a view projection matrix as ax+by+cz+d, inside is where all are positive
+vec4_t *getfrustumplanes(vec4_t *out, mat4_t *vp);//out holds 6
+int boxinfrustum(vec4_t *planes, vec3_t low, vec3_t high);
+
 #endif
@@ -0,0 +1,262 @@
+#include "dag.h"
+
+#include <string.h>
+
+#include <SDL.h>
+
+#include "hmap.h"
+#include "debug.h"
+#include "defines.h"
+
+#define NONE 0
+#define PAGE_SIZE (1 << DAG_PAGE_BITS)
+
+struct dag_node_s {
+	uint32_t refs; //0 for free nodes
+	uint32_t hash;
+	int8_t isleaf;
+
+	union {
+		block_t block;
+		dag_node_t children[8];
+		dag_node_t nextfree;
+	} data;
+};
+
+/*
+ * nodes live in fixed size pages that never move, so readers can follow
+ * node ids without taking the lock while other threads add nodes.
+ */
+static struct dag_node_s *pages[DAG_MAX_PAGES];
+static uint32_t numpages = 0;
+static uint32_t used = 0;
+static uint32_t freelist = NONE;
+static size_t numnodes = 0;
+
+static hmap_t *table = 0;
+static SDL_mutex *mutex = 0;
+
+//murmur3 finalizer, hash_uint32() collides too often on small ids
+static inline uint32_t
+mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline struct dag_node_s *
+node_get(dag_node_t node)
+{
+	return &pages[node >> DAG_PAGE_BITS][node & (PAGE_SIZE - 1)];
+}
+
+static uint32_t
+node_hash(const void *key)
+{
+	return ((const struct dag_node_s *)key)->hash;
+}
+
+static int
+node_compare(const void *a, const void *b)
+{
+	const struct dag_node_s *na = a;
+	const struct dag_node_s *nb = b;
+	if(na->isleaf != nb->isleaf)
+		return 0;
+	if(na->isleaf)
+		return !memcmp(&na->data.block, &nb->data.block, sizeof(block_t));
+	return !memcmp(na->data.children, nb->data.children, sizeof(na->data.children));
+}
+
+static dag_node_t
+alloc_node()
+{
+	dag_node_t node;
+	if(freelist != NONE)
+	{
+		node = freelist;
+		freelist = node_get(node)->data.nextfree;
+		return node;
+	}
+
+	if(used == numpages * PAGE_SIZE)
+	{
+		if(numpages == DAG_MAX_PAGES)
+			fail("dag node pages exhausted");
+		pages[numpages] = malloc(PAGE_SIZE * sizeof(struct dag_node_s));
+		if(!pages[numpages])
+			fail("dag page malloc failed");
+		numpages++;
+	}
+
+	return used++;
+}
+
+//returns a reference to the node equal to *tmp, creating it if needed
+static dag_node_t
+intern(struct dag_node_s *tmp)
+{
+	dag_node_t node = (uintptr_t)hmap_lookup(table, tmp);
+	if(node != NONE)
+	{
+		node_get(node)->refs++;
+		return node;
+	}
+
+	node = alloc_node();
+	struct dag_node_s *n = node_get(node);
+	*n = *tmp;
+	n->refs = 1;
+	hmap_insert(table, n, (void *)(uintptr_t)node);
+	numnodes++;
+	return node;
+}
+
+void
+dag_static_init()
+{
+	mutex = SDL_CreateMutex();
+	table = hmap_create(node_hash, node_compare, 0, 0);
+	used = 1; //NONE
+	freelist = NONE;
+	numnodes = 0;
+
+	pages[0] = malloc(PAGE_SIZE * sizeof(struct dag_node_s));
+	if(!pages[0])
+		fail("dag page malloc failed");
+	numpages = 1;
+}
+
+void
+dag_static_cleanup()
+{
+	if(numnodes)
+		error("dag_static_cleanup(): %lu nodes still referenced", (unsigned long)numnodes);
+
+	uint32_t i;
+	for(i=0; i<numpages; i++)
+		free(pages[i]);
+	numpages = 0;
+
+	hmap_destroy(table);
+	table = 0;
+	SDL_DestroyMutex(mutex);
+	mutex = 0;
+}
+
+void
+dag_lock()
+{
+	SDL_LockMutex(mutex);
+}
+
+void
+dag_unlock()
+{
+	SDL_UnlockMutex(mutex);
+}
+
+dag_node_t
+dag_leaf(block_t block)
+{
+	struct dag_node_s tmp;
+	tmp.isleaf = 1;
+	tmp.data.block = block;
+	tmp.hash = mix(block.id ^ mix(block.metadata.number + 1));
+	return intern(&tmp);
+}
+
+dag_node_t
+dag_inner(const dag_node_t children[8])
+{
+	int i;
+	int childrens = 1;
+	for(i=1; i<8; i++)
+		if(children[i] == children[0])
+			childrens++;
+
+	//8 equal leaves are one bigger leaf
+	if(childrens == 8 && node_get(children[0])->isleaf)
+	{
+		node_get(children[0])->refs -= 7;
+		return children[0];
+	}
+
+	struct dag_node_s tmp;
+	tmp.isleaf = 0;
+	memcpy(tmp.data.children, children, sizeof(tmp.data.children));
+	tmp.hash = 0x9e3779b9;
+	for(i=0; i<8; i++)
+		tmp.hash = mix(tmp.hash ^ children[i]);
+
+	dag_node_t node = intern(&tmp);
+	if(node_get(node)->refs > 1)
+	{
+		//already existed and holds its own references
+		for(i=0; i<8; i++)
+			node_get(children[i])->refs--;
+	}
+	return node;
+}
+
+void
+dag_ref(dag_node_t node)
+{
+	node_get(node)->refs++;
+}
+
+void
+dag_unref(dag_node_t node)
+{
+	struct dag_node_s *n = node_get(node);
+	if(--n->refs)
+		return;
+
+	hmap_remove(table, n);
+	numnodes--;
+
+	if(!n->isleaf)
+	{
+		int i;
+		for(i=0; i<8; i++)
+			dag_unref(n->data.children[i]);
+	}
+
+	n->data.nextfree = freelist;
+	freelist = node;
+}
+
+int
+dag_isleaf(dag_node_t node)
+{
+	return node_get(node)->isleaf;
+}
+
+block_t
+dag_block(dag_node_t node)
+{
+	return node_get(node)->data.block;
+}
+
+dag_node_t
+dag_child(dag_node_t node, int i)
+{
+	return node_get(node)->data.children[i];
+}
+
+size_t
+dag_nodes_get()
+{
+	return numnodes;
+}
+
+size_t
+dag_memory_get()
+{
+	//pages plus roughly one hash table entry per node
+	return numpages * PAGE_SIZE * sizeof(struct dag_node_s) + numnodes * (sizeof(void *) * 2 + sizeof(uint32_t));
+}
@@ -0,0 +1,36 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "block.h"
+
+/*
+ * global store of interned, reference counted octree nodes. Equal subtrees
+ * anywhere in the world are the same node, so trees built from it form a
+ * DAG. Nodes never change once created; trees edit by building new paths.
+ */
+typedef uint32_t dag_node_t;
+
+void dag_static_init();
+void dag_static_cleanup();
+
+//creating and releasing nodes needs the lock
+void dag_lock();
+void dag_unlock();
+
+dag_node_t dag_leaf(block_t block);
+dag_node_t dag_inner(const dag_node_t children[8]); //takes over the references to children
+void dag_ref(dag_node_t node);
+void dag_unref(dag_node_t node);
+
+//reading does not, as long as the caller holds a reference
+int dag_isleaf(dag_node_t node);
+block_t dag_block(dag_node_t node);
+dag_node_t dag_child(dag_node_t node, int i);
+
+size_t dag_nodes_get();
+size_t dag_memory_get();
+
+#endif
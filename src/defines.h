@@ -11,6 +11,8 @@
 #define CHUNK_LEVELS 5
 
 #define WORLD_CHUNKS_PER_EDGE 9
+#define WORLD_REMESH_THREADS 2 /* workers waiting on the remesh queue, besides the one for instant edits */
+#define WORLD_LOD_DISTANCE 3 /* chunks this many rings from the center mesh at half resolution, halved again each ring further */
 
 #define WORLDGEN_BUMPYNESS 3
 #define WORLDGEN_RANGE 0.5
@@ -18,8 +20,23 @@
 
 #define CHUNK_UNCOMPRESS 200
 #define CHUNK_RECOMPRESS 100
+#define CHUNK_PALETTE 10 /* accesses per tick to leave the octree */
+#define CHUNK_PALETTE_LEAVE 2 /* and to go back */
+#define CHUNK_ACCESS_DECAY 5 /* access counters average over 2^n ticks */
+#define CHUNK_READ_WEIGHT 16 /* reads per write */
+#define CHUNK_READ_SAMPLE 16 /* single block reads are counted at one position in this many, a power of two */
+#define CHUNK_UNCOMPRESSED_BUDGET (64 << 20) /* bytes of raw and palette chunks */
+#define CHUNK_LOCK_SPINS 64 /* failed tries before a waiting thread sleeps */
+#define CHUNK_LOCK_BENCHMARK_MS 500
+#define CHUNK_MESHER_BENCHMARK_RUNS 8 /* meshes of each chunk per mesher */
+#define CHUNK_LOD_MAX 3 /* coarsest lod, in cells of 2^n blocks */
 
 #define OCTREE_ZLIB_COMPRESSION_LEVEL -1 /* -1 to 9 */
+#define OCTREE_ARENA_INITIAL_NODES 65 /* root + 8 groups of 8, grows by doubling */
+#define OCTREE_SHARED_NODES 0 /* 1 to intern nodes across chunks in the dag, 0 for per tree arenas. Shared edits take one global lock */
+
+#define DAG_PAGE_BITS 12 /* nodes per page, as a power of 2 */
+#define DAG_MAX_PAGES 4096
 
 #define PLAYER_FLY_SPEED 55
 #define PLAYER_FRICTION 20
@@ -88,6 +88,24 @@ entity_jump(entity_t *entity, double y)
 	entity->hasjumped=1;
 }
 
+//solidity of the blocks around a moving entity, read in one go
+struct surroundings_s {
+	long3_t low;
+	long3_t high;
+	uint8_t *solid;
+};
+
+static int
+issolid(const struct surroundings_s *s, long x, long y, long z)
+{
+	if(x < s->low.x || y < s->low.y || z < s->low.z || x >= s->high.x || y >= s->high.y || z >= s->high.z)
+		return world_block_solid(x, y, z, 0);
+
+	long sx = s->high.x - s->low.x;
+	long sy = s->high.y - s->low.y;
+	return s->solid[(x - s->low.x) + (y - s->low.y)*sx + (z - s->low.z)*sx*sy];
+}
+
 void
 entity_move(entity_t *entity, vec3_t *delta)
 {
@@ -95,6 +113,17 @@ entity_move(entity_t *entity, vec3_t *delta)
 	double halfw = entity->w / 2.0;
 	long a, b;
 
+	//every block tested below lies between the start and end positions
+	struct surroundings_s s;
+	s.low.x = floor(fmin(startpos.x, startpos.x + delta->x) - halfw);
+	s.low.y = floor(fmin(startpos.y, startpos.y + delta->y));
+	s.low.z = floor(fmin(startpos.z, startpos.z + delta->z) - halfw);
+	s.high.x = floor(fmax(startpos.x, startpos.x + delta->x) + halfw) + 1;
+	s.high.y = floor(fmax(startpos.y, startpos.y + delta->y) + entity->h) + 1;
+	s.high.z = floor(fmax(startpos.z, startpos.z + delta->z) + halfw) + 1;
+	s.solid = malloc((s.high.x - s.low.x) * (s.high.y - s.low.y) * (s.high.z - s.low.z));
+	world_solid_get_box(s.low, s.high, s.solid);
+
 	entity->pos.x += delta->x;
 	a = floor(startpos.x + halfw);
 	b = floor(entity->pos.x + halfw);
@@ -105,7 +134,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(z = floor(entity->pos.z - halfw); z < entity->pos.z + halfw; z++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(b, y, z, 0).id))
+				if(issolid(&s, b, y, z))
 				{
 					entity->pos.x = b - halfw -.0001;
 					entity->velocity.x = 0;
@@ -124,7 +153,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(z = floor(entity->pos.z - halfw); z < entity->pos.z + halfw; z++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(b, y, z, 0).id))
+				if(issolid(&s, b, y, z))
 				{
 					entity->pos.x = b + 1 + halfw + .0001;
 					entity->velocity.x = 0;
@@ -144,7 +173,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(z = floor(entity->pos.z - halfw); z < entity->pos.z + halfw; z++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(x, b, z, 0).id))
+				if(issolid(&s, x, b, z))
 				{
 					entity->pos.y = b - entity->h - .0001;
 					entity->velocity.y = 0;
@@ -162,7 +191,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(z = floor(entity->pos.z - halfw); z < entity->pos.z + halfw; z++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(x, b, z, 0).id))
+				if(issolid(&s, x, b, z))
 				{
 					entity->pos.y = b + 1;
 					entity->velocity.y = 0;
@@ -183,7 +212,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(x = floor(entity->pos.x - halfw); x < entity->pos.x + halfw; x++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(x, y, b, 0).id))
+				if(issolid(&s, x, y, b))
 				{
 					entity->pos.z = b - halfw - .0001;
 					entity->velocity.z = 0;
@@ -201,7 +230,7 @@ entity_move(entity_t *entity, vec3_t *delta)
 		{
 			for(x = floor(entity->pos.x - halfw); x < entity->pos.x + halfw; x++)
 			{
-				if(BLOCK_PROPERTY_SOLID(world_block_get(x, y, b, 0).id))
+				if(issolid(&s, x, y, b))
 				{
 					entity->pos.z = b + 1 + halfw + .0001;
 					entity->velocity.z = 0;
@@ -210,6 +239,8 @@ entity_move(entity_t *entity, vec3_t *delta)
 			}
 		}
 	}
+
+	free(s.solid);
 }
 
 void
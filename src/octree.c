@@ -4,156 +4,630 @@
 #include <string.h>
 
 #include "modulo.h"
+#include "minmax.h"
 #include "stack.h"
+#include "dag.h"
 #include "debug.h"
 #include "save.h"
+#include "defines.h"
+
+#define ROOT 0
+#define NONE 0 //the root can never be a child, so 0 doubles as a null offset
 
 struct node_s {
 	int8_t isleaf;
 
 	union {
 		block_t block;
-		struct node_s *children;
+		uint32_t children; //offset of the first of 8 siblings in the arena
+		uint32_t nextfree; //free list link, only valid on the first node of a free group
 	} data;
 };
 
-octree_t
-*octree_create()
+/*
+ * All nodes of a tree live in one contiguous arena. Children are always
+ * allocated as groups of 8 siblings and addressed by their offset, so the
+ * arena can be grown with a single realloc. Groups freed by a merge are kept
+ * on a free list and handed out again before the arena grows.
+ */
+struct octree_s {
+	struct node_s *nodes;
+	uint32_t size; //in nodes
+	uint32_t used; //high water mark, in nodes
+	uint32_t freelist;
+
+	//shared trees have no arena, only a reference to their root in the dag
+	int shared;
+	dag_node_t root;
+};
+
+/*
+ * read only walks go through these, so they work on both kinds of tree.
+ * Node ids are arena offsets or dag nodes.
+ */
+static inline uint32_t
+tree_root(const octree_t *tree)
 {
-	octree_t *tree = calloc(1, sizeof(octree_t));
-	tree->isleaf = 1;
-	tree->data.block.id = AIR;
-	return tree;
+	return tree->shared ? tree->root : ROOT;
+}
+
+static inline int
+node_isleaf(const octree_t *tree, uint32_t node)
+{
+	return tree->shared ? dag_isleaf(node) : tree->nodes[node].isleaf;
+}
+
+static inline block_t
+node_block(const octree_t *tree, uint32_t node)
+{
+	return tree->shared ? dag_block(node) : tree->nodes[node].data.block;
+}
+
+static inline uint32_t
+node_child(const octree_t *tree, uint32_t node, int i)
+{
+	return tree->shared ? dag_child(node, i) : tree->nodes[node].data.children + i;
 }
 
 static void
-destroy(octree_t *tree)
+reset(octree_t *tree)
 {
-	int i;
-	if(!tree->isleaf)
+	tree->used = 1;
+	tree->freelist = NONE;
+	tree->nodes[ROOT].isleaf = 1;
+	tree->nodes[ROOT].data.block.id = AIR;
+	tree->nodes[ROOT].data.block.metadata.number = 0;
+}
+
+static uint32_t
+alloc_children(octree_t *tree)
+{
+	uint32_t children;
+	if(tree->freelist != NONE)
 	{
-		for(i=0; i<8; i++)
-			destroy(&tree->data.children[i]);
-		free(tree->data.children);
+		children = tree->freelist;
+		tree->freelist = tree->nodes[children].data.nextfree;
+		return children;
+	}
+
+	if(tree->used + 8 > tree->size)
+	{
+		uint32_t size = tree->size * 2;
+		struct node_s *nodes = realloc(tree->nodes, size * sizeof(struct node_s));
+		if(!nodes)
+			fail("octree arena realloc failed");
+		tree->nodes = nodes;
+		tree->size = size;
 	}
+
+	children = tree->used;
+	tree->used += 8;
+	return children;
+}
+
+static void
+free_children(octree_t *tree, uint32_t children)
+{
+	tree->nodes[children].data.nextfree = tree->freelist;
+	tree->freelist = children;
+}
+
+static octree_t *
+create_arena()
+{
+	octree_t *tree = malloc(sizeof(octree_t));
+	tree->size = OCTREE_ARENA_INITIAL_NODES;
+	tree->nodes = malloc(tree->size * sizeof(struct node_s));
+	if(!tree->nodes)
+		fail("octree arena malloc failed");
+	tree->shared = 0;
+	tree->root = 0;
+	reset(tree);
+	return tree;
+}
+
+static dag_node_t
+intern_subtree(const octree_t *tree, uint32_t node)
+{
+	const struct node_s *n = &tree->nodes[node];
+	if(n->isleaf)
+		return dag_leaf(n->data.block);
+
+	int i;
+	dag_node_t children[8];
+	for(i=0; i<8; i++)
+		children[i] = intern_subtree(tree, n->data.children + i);
+	return dag_inner(children);
+}
+
+//moves the nodes of an arena tree into the dag and drops the arena
+static void
+share(octree_t *tree)
+{
+	dag_lock();
+	tree->root = intern_subtree(tree, ROOT);
+	dag_unlock();
+
+	free(tree->nodes);
+	tree->nodes = 0;
+	tree->size = 0;
+	tree->shared = 1;
+}
+
+octree_t *
+octree_create()
+{
+	octree_t *tree = create_arena();
+	if(OCTREE_SHARED_NODES)
+		share(tree);
+	return tree;
 }
 
 void
 octree_destroy(octree_t *tree)
 {
-	destroy(tree);
+	if(tree->shared)
+	{
+		dag_lock();
+		dag_unref(tree->root);
+		dag_unlock();
+	}
+	free(tree->nodes);
 	free(tree);
 }
 
 void
 octree_zero(octree_t *tree)
 {
-	destroy(tree);
-	tree->isleaf = 1;
-	tree->data.block.id = AIR;
+	if(tree->shared)
+	{
+		block_t air = {AIR, {0}};
+		dag_lock();
+		dag_unref(tree->root);
+		tree->root = dag_leaf(air);
+		dag_unlock();
+	} else {
+		reset(tree);
+	}
+}
+
+static uint32_t
+count_nodes(const struct node_s *nodes, uint32_t node)
+{
+	if(nodes[node].isleaf)
+		return 1;
+
+	int i;
+	uint32_t count = 1;
+	for(i=0; i<8; i++)
+		count += count_nodes(nodes, nodes[node].data.children + i);
+	return count;
+}
+
+static void
+copy_nodes(const struct node_s *src, uint32_t node, struct node_s *dst, uint32_t to, uint32_t *used)
+{
+	dst[to] = src[node];
+	if(!src[node].isleaf)
+	{
+		int i;
+		uint32_t children = *used;
+		*used += 8;
+		dst[to].data.children = children;
+		for(i=0; i<8; i++)
+			copy_nodes(src, src[node].data.children + i, dst, children + i, used);
+	}
 }
 
-static block_t
-get(int8_t x, int8_t y, int8_t z, octree_t *tree, int8_t level)
+void
+octree_compact(octree_t *tree)
 {
-	if(tree->isleaf)
-		return tree->data.block;
-	int8_t x_ = (x*2 % CHUNKSIZE);
-	int8_t y_ = (y*2 % CHUNKSIZE);
-	int8_t z_ = (z*2 % CHUNKSIZE);
-	return get(x_, y_, z_, &tree->data.children[(x<CHUNKSIZE/2) | ((y<CHUNKSIZE/2) << 1) | ((z<CHUNKSIZE/2) << 2)], level + 1);
+	if(tree->shared)
+		return;
+
+	uint32_t size = count_nodes(tree->nodes, ROOT);
+	if(size < OCTREE_ARENA_INITIAL_NODES)
+		size = OCTREE_ARENA_INITIAL_NODES;
+
+	if(size == tree->size && tree->freelist == NONE)
+		return;
+
+	struct node_s *nodes = malloc(size * sizeof(struct node_s));
+	if(!nodes)
+		fail("octree arena malloc failed");
+
+	uint32_t used = 1;
+	copy_nodes(tree->nodes, ROOT, nodes, ROOT, &used);
+
+	free(tree->nodes);
+	tree->nodes = nodes;
+	tree->size = size;
+	tree->used = used;
+	tree->freelist = NONE;
+}
+
+size_t
+octree_memory_get(octree_t *tree)
+{
+	//shared nodes are accounted for in dag_memory_get()
+	return sizeof(octree_t) + tree->size * sizeof(struct node_s);
+}
+
+//true when the whole tree is a single leaf
+int
+octree_uniform_get(octree_t *tree, block_t *block)
+{
+	uint32_t root = tree_root(tree);
+	if(!node_isleaf(tree, root))
+		return 0;
+	*block = node_block(tree, root);
+	return 1;
 }
 
 block_t
 octree_get(int8_t x, int8_t y, int8_t z, octree_t *tree)
 {
-	return get(x, y, z, tree, 0);
+	uint32_t node = tree_root(tree);
+	while(!node_isleaf(tree, node))
+	{
+		int i = (x<CHUNKSIZE/2) | ((y<CHUNKSIZE/2) << 1) | ((z<CHUNKSIZE/2) << 2);
+		x = (x*2 % CHUNKSIZE);
+		y = (y*2 % CHUNKSIZE);
+		z = (z*2 % CHUNKSIZE);
+		node = node_child(tree, node, i);
+	}
+	return node_block(tree, node);
+}
+
+static void
+split(octree_t *tree, uint32_t node)
+{
+	int i;
+	block_t block = tree->nodes[node].data.block;
+
+	uint32_t children = alloc_children(tree);
+	for(i=0; i<8; i++)
+	{
+		tree->nodes[children + i].isleaf = 1;
+		tree->nodes[children + i].data.block = block;
+	}
+	tree->nodes[node].isleaf = 0;
+	tree->nodes[node].data.children = children;
+}
+
+static void
+merge(octree_t *tree, uint32_t node)
+{
+	int i;
+	uint32_t children = tree->nodes[node].data.children;
+	struct node_s *child = &tree->nodes[children];
+	if(child[0].isleaf)
+	{
+		block_t block = child[0].data.block;
+		int childrens = 1;
+		for(i=1; i<8; i++)
+		{
+			if(child[i].isleaf)
+				if(!memcmp(&(child[i].data.block), &block, sizeof(block_t)))
+					childrens++;
+		}
+		if(childrens == 8)
+		{
+			free_children(tree, children);
+			tree->nodes[node].isleaf = 1;
+			tree->nodes[node].data.block = block;
+		}
+	}
 }
 
 static void
-set(int8_t x, int8_t y, int8_t z, octree_t *tree, block_t *data, int8_t level)
+free_subtree(octree_t *tree, uint32_t children)
 {
 	int i;
+	for(i=0; i<8; i++)
+		if(!tree->nodes[children + i].isleaf)
+			free_subtree(tree, tree->nodes[children + i].data.children);
+	free_children(tree, children);
+}
+
+/*
+ * nodes are passed as offsets, not pointers, because splitting may move
+ * the arena.
+ */
+static void
+set(int8_t x, int8_t y, int8_t z, octree_t *tree, uint32_t node, block_t *data, int8_t level)
+{
 	if(level < CHUNK_LEVELS)
 	{
 		int8_t x_ = (x*2 % CHUNKSIZE);
 		int8_t y_ = (y*2 % CHUNKSIZE);
 		int8_t z_ = (z*2 % CHUNKSIZE);
-		if(tree->isleaf)
+		if(tree->nodes[node].isleaf)
 		{
-			if(!memcmp(data, &(tree->data.block), sizeof(block_t)))
+			if(!memcmp(data, &(tree->nodes[node].data.block), sizeof(block_t)))
 				return;
-			tree->isleaf = 0;
-			block_t block = tree->data.block;
-
-			tree->data.children = malloc(sizeof(struct node_s) * 8);
-			for(i=0; i<8; i++)
-			{
-				tree->data.children[i].isleaf = 1;
-				tree->data.children[i].data.block = block;
-			}
-		}
-		set(x_, y_, z_, &tree->data.children[(x<CHUNKSIZE/2) + (y<CHUNKSIZE/2)*2 + (z<CHUNKSIZE/2)*4], data, level +1);
-		if(tree->data.children[0].isleaf)
-		{
-			block_t block = tree->data.children[0].data.block;
-			int childrens = 1;
-			for(i=1; i<8; i++)
-			{
-				if(tree->data.children[i].isleaf)
-					if(!memcmp(&(tree->data.children[i].data.block), &block, sizeof(block_t)))
-						childrens++;
-			}
-			if(childrens == 8)
-			{
-				free(tree->data.children);
-				tree->isleaf = 1;
-				tree->data.block = block;
-			}
+			split(tree, node);
 		}
+		uint32_t children = tree->nodes[node].data.children;
+		set(x_, y_, z_, tree, children + (x<CHUNKSIZE/2) + (y<CHUNKSIZE/2)*2 + (z<CHUNKSIZE/2)*4, data, level +1);
+		merge(tree, node);
 	} else
-		tree->data.block = *data;
+		tree->nodes[node].data.block = *data;
 }
 
 void
 octree_set(int8_t x, int8_t y, int8_t z, octree_t *tree, block_t *data)
 {
-	set(x, y, z, tree, data, 0);
+	if(tree->shared)
+	{
+		octree_box_t box = {{x, y, z}, {x+1, y+1, z+1}};
+		octree_fill_box(tree, &box, data);
+		return;
+	}
+	set(x, y, z, tree, ROOT, data, 0);
+}
+
+/*
+ * builds the subtree covering the cube at (x, y, z) into *out. Children are
+ * built first, so uniform groups of 8 collapse into a leaf before anything
+ * is allocated for them.
+ */
+static void
+build(octree_t *tree, const block_t *blocks, int x, int y, int z, int8_t level, struct node_s *out)
+{
+	int i;
+	if(level == CHUNK_LEVELS)
+	{
+		out->isleaf = 1;
+		out->data.block = blocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE];
+		return;
+	}
+
+	int half = CHUNKSIZE >> (level + 1);
+	struct node_s child[8];
+	for(i=0; i<8; i++)
+		build(tree, blocks,
+				x + ((i & 1) ? 0 : half),
+				y + ((i & 2) ? 0 : half),
+				z + ((i & 4) ? 0 : half),
+				level + 1, &child[i]);
+
+	int childrens = 0;
+	if(child[0].isleaf)
+	{
+		for(i=0; i<8; i++)
+			if(child[i].isleaf && !memcmp(&child[i].data.block, &child[0].data.block, sizeof(block_t)))
+				childrens++;
+	}
+
+	if(childrens == 8)
+	{
+		*out = child[0];
+	} else {
+		uint32_t children = alloc_children(tree);
+		memcpy(&tree->nodes[children], child, sizeof(child));
+		out->isleaf = 0;
+		out->data.children = children;
+	}
+}
+
+octree_t *
+octree_build_from_dense(const block_t *blocks)
+{
+	octree_t *tree = create_arena();
+	struct node_s root;
+	build(tree, blocks, 0, 0, 0, 0, &root);
+	tree->nodes[ROOT] = root;
+	if(OCTREE_SHARED_NODES)
+		share(tree);
+	else
+		octree_compact(tree);
+	return tree;
+}
+
+static inline int
+box_overlaps(const octree_box_t *box, int x, int y, int z, int size)
+{
+	return x < box->high.x && box->low.x < x + size &&
+		y < box->high.y && box->low.y < y + size &&
+		z < box->high.z && box->low.z < z + size;
+}
+
+static inline int
+box_contains(const octree_box_t *box, int x, int y, int z, int size)
+{
+	return box->low.x <= x && x + size <= box->high.x &&
+		box->low.y <= y && y + size <= box->high.y &&
+		box->low.z <= z && z + size <= box->high.z;
+}
+
+static void
+visit(octree_t *tree, uint32_t node, int x, int y, int z, int size, const octree_box_t *box, octree_visit_func func, void *ptr)
+{
+	if(!box_overlaps(box, x, y, z, size))
+		return;
+
+	if(node_isleaf(tree, node))
+	{
+		octree_box_t bounds = {
+			{MAX(x, box->low.x), MAX(y, box->low.y), MAX(z, box->low.z)},
+			{MIN(x + size, box->high.x), MIN(y + size, box->high.y), MIN(z + size, box->high.z)}
+		};
+		func(&bounds, node_block(tree, node), ptr);
+		return;
+	}
+
+	int i;
+	int half = size / 2;
+	for(i=0; i<8; i++)
+		visit(tree, node_child(tree, node, i),
+				x + ((i & 1) ? 0 : half),
+				y + ((i & 2) ? 0 : half),
+				z + ((i & 4) ? 0 : half),
+				half, box, func, ptr);
+}
+
+void
+octree_visit_leaves(octree_t *tree, const octree_box_t *box, octree_visit_func func, void *ptr)
+{
+	visit(tree, tree_root(tree), 0, 0, 0, CHUNKSIZE, box, func, ptr);
+}
+
+static void
+fill(octree_t *tree, uint32_t node, int x, int y, int z, int size, const octree_box_t *box, block_t *data)
+{
+	if(!box_overlaps(box, x, y, z, size))
+		return;
+
+	if(box_contains(box, x, y, z, size))
+	{
+		if(!tree->nodes[node].isleaf)
+			free_subtree(tree, tree->nodes[node].data.children);
+		tree->nodes[node].isleaf = 1;
+		tree->nodes[node].data.block = *data;
+		return;
+	}
+
+	if(tree->nodes[node].isleaf)
+	{
+		if(!memcmp(data, &(tree->nodes[node].data.block), sizeof(block_t)))
+			return;
+		split(tree, node);
+	}
+
+	int i;
+	int half = size / 2;
+	uint32_t children = tree->nodes[node].data.children;
+	for(i=0; i<8; i++)
+		fill(tree, children + i,
+				x + ((i & 1) ? 0 : half),
+				y + ((i & 2) ? 0 : half),
+				z + ((i & 4) ? 0 : half),
+				half, box, data);
+	merge(tree, node);
+}
+
+/*
+ * shared nodes are never edited in place. Returns a reference to a filled
+ * copy of node that reuses every subtree the box does not cover.
+ */
+static dag_node_t
+fill_shared(dag_node_t node, int x, int y, int z, int size, const octree_box_t *box, block_t *data)
+{
+	if(!box_overlaps(box, x, y, z, size))
+	{
+		dag_ref(node);
+		return node;
+	}
+
+	if(box_contains(box, x, y, z, size))
+		return dag_leaf(*data);
+
+	int isleaf = dag_isleaf(node);
+	if(isleaf)
+	{
+		block_t block = dag_block(node);
+		if(!memcmp(data, &block, sizeof(block_t)))
+		{
+			dag_ref(node);
+			return node;
+		}
+	}
+
+	int i;
+	int half = size / 2;
+	dag_node_t children[8];
+	for(i=0; i<8; i++)
+		children[i] = fill_shared(isleaf ? node : dag_child(node, i),
+				x + ((i & 1) ? 0 : half),
+				y + ((i & 2) ? 0 : half),
+				z + ((i & 4) ? 0 : half),
+				half, box, data);
+	return dag_inner(children);
+}
+
+void
+octree_fill_box(octree_t *tree, const octree_box_t *box, block_t *data)
+{
+	if(tree->shared)
+	{
+		dag_lock();
+		dag_node_t root = fill_shared(tree->root, 0, 0, 0, CHUNKSIZE, box, data);
+		dag_unref(tree->root);
+		tree->root = root;
+		dag_unlock();
+		return;
+	}
+	fill(tree, ROOT, 0, 0, 0, CHUNKSIZE, box, data);
 }
 
-void write_node(octree_t *tree, struct stack *stack);
+static void
+to_dense(const octree_t *tree, uint32_t node, int x, int y, int z, int size, block_t *blocks)
+{
+	if(node_isleaf(tree, node))
+	{
+		block_t block = node_block(tree, node);
+		int x_, y_, z_;
+		for(z_=z; z_<z+size; ++z_)
+		for(y_=y; y_<y+size; ++y_)
+		{
+			block_t *row = &blocks[y_*CHUNKSIZE + z_*CHUNKSIZE*CHUNKSIZE];
+			for(x_=x; x_<x+size; ++x_)
+				row[x_] = block;
+		}
+		return;
+	}
+
+	int i;
+	int half = size / 2;
+	for(i=0; i<8; i++)
+		to_dense(tree, node_child(tree, node, i),
+				x + ((i & 1) ? 0 : half),
+				y + ((i & 2) ? 0 : half),
+				z + ((i & 4) ? 0 : half),
+				half, blocks);
+}
 
 void
-write_nonleaf(octree_t *tree, struct stack *stack)
+octree_to_dense(octree_t *tree, block_t *blocks)
+{
+	to_dense(tree, tree_root(tree), 0, 0, 0, CHUNKSIZE, blocks);
+}
+
+static void write_node(octree_t *tree, uint32_t node, struct stack *stack);
+
+static void
+write_nonleaf(octree_t *tree, uint32_t node, struct stack *stack)
 {
 	static char static_L = 'N';
 	stack_push(stack, &static_L);
 
 	int i;
 	for(i=0; i<8; i++)
-		write_node(&tree->data.children[i], stack);
+		write_node(tree, node_child(tree, node, i), stack);
 }
 
-void
-write_leaf(octree_t *tree, struct stack *stack)
+static void
+write_leaf(octree_t *tree, uint32_t node, struct stack *stack)
 {
 	static char static_B = 'L';
 	stack_push(stack, &static_B);
 
+	block_t block = node_block(tree, node);
 	unsigned char tmp[4];
-	save_write_uint16(tmp, tree->data.block.id);
+	save_write_uint16(tmp, block.id);
 	stack_push_mult(stack, tmp, 2);
-	save_write_uint32(tmp, tree->data.block.metadata.number);
+	save_write_uint32(tmp, block.metadata.number);
 	stack_push_mult(stack, tmp, 4);
 }
 
-void
-write_node(octree_t *tree, struct stack *stack)
+static void
+write_node(octree_t *tree, uint32_t node, struct stack *stack)
 {
-	if(tree->isleaf)
-		write_leaf(tree, stack);
+	if(node_isleaf(tree, node))
+		write_leaf(tree, node, stack);
 	else
-		write_nonleaf(tree, stack);
+		write_nonleaf(tree, node, stack);
 }
 
 size_t
@@ -162,7 +636,7 @@ octree_dump(octree_t *tree, unsigned char **data)
 	//TODO: constants
 	stack_t *stack = stack_create(1, 10000, 2.0);
 
-	write_node(tree, stack);
+	write_node(tree, tree_root(tree), stack);
 
 	stack_trim(stack);
 
@@ -174,40 +648,42 @@ octree_dump(octree_t *tree, unsigned char **data)
 	return stack_size;
 }
 
-size_t read_node(octree_t *tree, const unsigned char *data);
+static size_t read_node(octree_t *tree, uint32_t node, const unsigned char *data);
 
-size_t
-read_nonleaf(octree_t *tree, const unsigned char *data)
+static size_t
+read_nonleaf(octree_t *tree, uint32_t node, const unsigned char *data)
 {
 	size_t size = 1;
-	tree->isleaf = 0;
 
 	int i = 0;
-	tree->data.children = malloc(sizeof(struct node_s) * 8);
+	uint32_t children = alloc_children(tree);
+	tree->nodes[node].isleaf = 0;
+	tree->nodes[node].data.children = children;
 	for(i=0; i<8; i++)
-		size += read_node(&tree->data.children[i], data + size);
+		size += read_node(tree, children + i, data + size);
 
 	return size;
 }
 
-size_t
-read_leaf(octree_t *tree, const unsigned char *data)
+static size_t
+read_leaf(octree_t *tree, uint32_t node, const unsigned char *data)
 {
-	tree->isleaf = 1;
-	tree->data.block.id = 0;
-	tree->data.block.id = save_read_uint16(data+1);
-	tree->data.block.metadata.number = save_read_uint32(data+3);
+	struct node_s *leaf = &tree->nodes[node];
+	leaf->isleaf = 1;
+	leaf->data.block.id = 0;
+	leaf->data.block.id = save_read_uint16(data+1);
+	leaf->data.block.metadata.number = save_read_uint32(data+3);
 
 	return 7;
 }
 
-size_t
-read_node(octree_t *tree, const unsigned char *data)
+static size_t
+read_node(octree_t *tree, uint32_t node, const unsigned char *data)
 {
 	if(data[0] == 'L')
-		return read_leaf(tree, data);
+		return read_leaf(tree, node, data);
 	else if(data[0] == 'N')
-		return read_nonleaf(tree, data);
+		return read_nonleaf(tree, node, data);
 	else
 		fail("byte not 'N' or 'L' reading octree from binary dump");
 
@@ -217,7 +693,285 @@ read_node(octree_t *tree, const unsigned char *data)
 octree_t *
 octree_read(const unsigned char *data)
 {
-	octree_t *octree = octree_create();
-	read_node(octree, data);
+	octree_t *octree = create_arena();
+	read_node(octree, ROOT, data);
+	if(OCTREE_SHARED_NODES)
+		share(octree);
+	else
+		octree_compact(octree);
+	return octree;
+}
+
+/*
+ * PACKED FORMAT
+ *
+ * uint16: palette_len
+ * uint16[palette_len]: block ids
+ * uint32: num_nodes
+ * bits[num_nodes]: 1 for a nonleaf, 0 for a leaf, depth first
+ * bits[num_leaves * index_bits]: palette index of each leaf, depth first
+ * uint32[]: metadata of each leaf whose block type has metadata
+ *
+ * bit streams are lsb first and padded to a whole byte. index_bits is the
+ * smallest width that can hold palette_len-1, so a one entry palette has
+ * no index stream at all.
+ */
+
+struct bitwriter {
+	stack_t *stack;
+	uint32_t acc;
+	int bits;
+};
+
+struct bitreader {
+	const unsigned char *data;
+	size_t pos; //in bits
+};
+
+struct packer {
+	uint16_t palette[BLOCK_NUM_TYPES];
+	int palette_len;
+	int index_bits;
+	uint32_t num_nodes;
+
+	struct bitwriter tags;
+	struct bitwriter indices;
+	stack_t *metadata;
+};
+
+static inline int
+has_metadata(blockid_t id)
+{
+	return id < BLOCK_NUM_TYPES && BLOCK_PROPERTY_HASMETADATA(id);
+}
+
+static void
+bits_write(struct bitwriter *w, uint32_t value, int bits)
+{
+	w->acc |= value << w->bits;
+	w->bits += bits;
+	while(w->bits >= 8)
+	{
+		unsigned char c = w->acc & 0xff;
+		stack_push(w->stack, &c);
+		w->acc >>= 8;
+		w->bits -= 8;
+	}
+}
+
+static void
+bits_flush(struct bitwriter *w)
+{
+	if(w->bits > 0)
+		bits_write(w, 0, 8 - w->bits);
+}
+
+static uint32_t
+bits_read(struct bitreader *r, int bits)
+{
+	int i;
+	uint32_t value = 0;
+	for(i=0; i<bits; i++)
+	{
+		value |= ((r->data[r->pos >> 3] >> (r->pos & 7)) & 1) << i;
+		r->pos++;
+	}
+	return value;
+}
+
+static int
+palette_index(struct packer *p, blockid_t id)
+{
+	int i;
+	for(i=0; i<p->palette_len; i++)
+		if(p->palette[i] == id)
+			return i;
+	return -1;
+}
+
+static void
+pack_scan(octree_t *tree, uint32_t node, struct packer *p)
+{
+	p->num_nodes++;
+	if(node_isleaf(tree, node))
+	{
+		blockid_t id = node_block(tree, node).id;
+		if(palette_index(p, id) < 0)
+		{
+			if(p->palette_len == BLOCK_NUM_TYPES)
+				fail("octree_dump_packed(): block id out of range");
+			p->palette[p->palette_len++] = id;
+		}
+		return;
+	}
+
+	int i;
+	for(i=0; i<8; i++)
+		pack_scan(tree, node_child(tree, node, i), p);
+}
+
+static void
+pack_node(octree_t *tree, uint32_t node, struct packer *p)
+{
+	int isleaf = node_isleaf(tree, node);
+	bits_write(&p->tags, !isleaf, 1);
+	if(isleaf)
+	{
+		block_t block = node_block(tree, node);
+		bits_write(&p->indices, palette_index(p, block.id), p->index_bits);
+		if(has_metadata(block.id))
+		{
+			unsigned char tmp[4];
+			save_write_uint32(tmp, block.metadata.number);
+			stack_push_mult(p->metadata, tmp, 4);
+		}
+		return;
+	}
+
+	int i;
+	for(i=0; i<8; i++)
+		pack_node(tree, node_child(tree, node, i), p);
+}
+
+size_t
+octree_dump_packed(octree_t *tree, unsigned char **data)
+{
+	struct packer p;
+	p.palette_len = 0;
+	p.num_nodes = 0;
+	pack_scan(tree, tree_root(tree), &p);
+
+	p.index_bits = 0;
+	while((1 << p.index_bits) < p.palette_len)
+		p.index_bits++;
+
+	//TODO: constants
+	stack_t *stack = stack_create(1, 1000, 2.0);
+	p.tags.stack = stack;
+	p.tags.acc = 0;
+	p.tags.bits = 0;
+	p.indices.stack = stack_create(1, 1000, 2.0);
+	p.indices.acc = 0;
+	p.indices.bits = 0;
+	p.metadata = stack_create(1, 100, 2.0);
+
+	unsigned char tmp[4];
+	int i;
+	save_write_uint16(tmp, p.palette_len);
+	stack_push_mult(stack, tmp, 2);
+	for(i=0; i<p.palette_len; i++)
+	{
+		save_write_uint16(tmp, p.palette[i]);
+		stack_push_mult(stack, tmp, 2);
+	}
+	save_write_uint32(tmp, p.num_nodes);
+	stack_push_mult(stack, tmp, 4);
+
+	pack_node(tree, tree_root(tree), &p);
+	bits_flush(&p.tags);
+	bits_flush(&p.indices);
+
+	size_t indices_size = stack_objects_get_num(p.indices.stack);
+	size_t metadata_size = stack_objects_get_num(p.metadata);
+	if(indices_size)
+		stack_push_mult(stack, stack_element_ref(p.indices.stack, 0), indices_size);
+	if(metadata_size)
+		stack_push_mult(stack, stack_element_ref(p.metadata, 0), metadata_size);
+	stack_destroy(p.indices.stack);
+	stack_destroy(p.metadata);
+
+	stack_trim(stack);
+
+	size_t stack_size = stack_objects_get_num(stack);
+	*data = stack_transform_dataptr(stack);
+	if(!(*data))
+		fail("octree_dump_packed(): failed to take the data of the stack");
+
+	return stack_size;
+}
+
+struct unpacker {
+	blockid_t palette[BLOCK_NUM_TYPES];
+	int palette_len;
+	int index_bits;
+
+	struct bitreader tags;
+	struct bitreader indices;
+	const unsigned char *metadata;
+};
+
+static void
+unpack_node(octree_t *tree, uint32_t node, struct unpacker *u, int8_t level)
+{
+	if(bits_read(&u->tags, 1))
+	{
+		if(level >= CHUNK_LEVELS)
+			fail("nonleaf below the last level reading packed octree");
+
+		int i;
+		uint32_t children = alloc_children(tree);
+		tree->nodes[node].isleaf = 0;
+		tree->nodes[node].data.children = children;
+		for(i=0; i<8; i++)
+			unpack_node(tree, children + i, u, level + 1);
+		return;
+	}
+
+	uint32_t index = bits_read(&u->indices, u->index_bits);
+	if(index >= (uint32_t)u->palette_len)
+		fail("bad palette index reading packed octree");
+
+	struct node_s *leaf = &tree->nodes[node];
+	leaf->isleaf = 1;
+	leaf->data.block.id = u->palette[index];
+	leaf->data.block.metadata.number = 0;
+	if(has_metadata(leaf->data.block.id))
+	{
+		leaf->data.block.metadata.number = save_read_uint32(u->metadata);
+		u->metadata += 4;
+	}
+}
+
+octree_t *
+octree_read_packed(const unsigned char *data)
+{
+	struct unpacker u;
+
+	int i;
+	int palette_len = save_read_uint16(data);
+	data += 2;
+	if(palette_len < 1 || palette_len > BLOCK_NUM_TYPES)
+		fail("bad palette length reading packed octree");
+	for(i=0; i<palette_len; i++)
+	{
+		u.palette[i] = save_read_uint16(data + i*2);
+		if(u.palette[i] >= BLOCK_NUM_TYPES)
+			fail("bad block id reading packed octree");
+	}
+	data += palette_len*2;
+	u.palette_len = palette_len;
+
+	u.index_bits = 0;
+	while((1 << u.index_bits) < palette_len)
+		u.index_bits++;
+
+	uint32_t num_nodes = save_read_uint32(data);
+	data += 4;
+	uint32_t num_leaves = num_nodes - (num_nodes - 1) / 8;
+
+	u.tags.data = data;
+	u.tags.pos = 0;
+	data += (num_nodes + 7) / 8;
+	u.indices.data = data;
+	u.indices.pos = 0;
+	data += ((size_t)num_leaves * u.index_bits + 7) / 8;
+	u.metadata = data;
+
+	octree_t *octree = create_arena();
+	unpack_node(octree, ROOT, &u, 0);
+	if(OCTREE_SHARED_NODES)
+		share(octree);
+	else
+		octree_compact(octree);
 	return octree;
 }
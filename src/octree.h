@@ -7,16 +7,37 @@
 #include "block.h"
 #include "chunk.h"
 
-typedef struct node_s octree_t;
+typedef struct octree_s octree_t;
+
+//low is inclusive, high is exclusive
+typedef struct {
+	int3_t low;
+	int3_t high;
+} octree_box_t;
+
+//bounds are clipped to the visited box. must not modify the tree
+typedef void (*octree_visit_func)(const octree_box_t *bounds, block_t block, void *ptr);
 
 octree_t *octree_create();
 void octree_destroy(octree_t *tree);
 void octree_zero(octree_t *tree);
+void octree_compact(octree_t *tree);
+size_t octree_memory_get(octree_t *tree);
 
 block_t octree_get(int8_t x, int8_t y, int8_t z, octree_t *tree);
 void octree_set(int8_t x, int8_t y, int8_t z, octree_t *tree, block_t *data);
+int octree_uniform_get(octree_t *tree, block_t *block);
+
+void octree_visit_leaves(octree_t *tree, const octree_box_t *box, octree_visit_func func, void *ptr);
+void octree_fill_box(octree_t *tree, const octree_box_t *box, block_t *data);
+
+octree_t *octree_build_from_dense(const block_t *blocks);
+void octree_to_dense(octree_t *tree, block_t *blocks);
 
 size_t octree_dump(octree_t *tree, unsigned char **data);
 octree_t *octree_read(const unsigned char *data);
 
+size_t octree_dump_packed(octree_t *tree, unsigned char **data);
+octree_t *octree_read_packed(const unsigned char *data);
+
 #endif
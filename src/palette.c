@@ -0,0 +1,185 @@
+#include "palette.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "standard.h"
+
+#define VOLUME (CHUNKSIZE*CHUNKSIZE*CHUNKSIZE)
+
+/*
+ * A chunk stored as a list of distinct blocks plus a packed array with
+ * one palette index per voxel. Indices are 1, 2, 4 or 8 bits wide so they
+ * never straddle a word. Entries are never removed; the palette only
+ * grows until the chunk is converted to another representation.
+ */
+struct palette_s {
+	block_t *entries;
+	int len;
+	int size;
+
+	int bits;
+	uint32_t *indices;
+};
+
+static inline size_t
+indices_size(int bits)
+{
+	return VOLUME * bits / 32 * sizeof(uint32_t);
+}
+
+static inline uint32_t
+index_get(const uint32_t *indices, int bits, int i)
+{
+	size_t off = (size_t)i * bits;
+	return (indices[off >> 5] >> (off & 31)) & ((1u << bits) - 1);
+}
+
+static inline void
+index_set(uint32_t *indices, int bits, int i, uint32_t value)
+{
+	size_t off = (size_t)i * bits;
+	uint32_t mask = ((1u << bits) - 1) << (off & 31);
+	indices[off >> 5] = (indices[off >> 5] & ~mask) | (value << (off & 31));
+}
+
+static int
+bits_for(int len)
+{
+	int bits = 1;
+	while((1 << bits) < len)
+		bits *= 2;
+	return bits;
+}
+
+static int
+find_entry(palette_t *palette, const block_t *block)
+{
+	int i;
+	for(i=0; i<palette->len; i++)
+		if(!memcmp(&palette->entries[i], block, sizeof(block_t)))
+			return i;
+	return -1;
+}
+
+static int
+add_entry(palette_t *palette, const block_t *block)
+{
+	if(palette->len == PALETTE_MAX_ENTRIES)
+		return -1;
+
+	if(palette->len == palette->size)
+	{
+		palette->size *= 2;
+		palette->entries = realloc(palette->entries, palette->size * sizeof(block_t));
+		if(!palette->entries)
+			fail("palette realloc failed");
+	}
+
+	palette->entries[palette->len] = *block;
+	return palette->len++;
+}
+
+static void
+repack(palette_t *palette, int bits)
+{
+	uint32_t *indices = calloc(1, indices_size(bits));
+	if(!indices)
+		fail("palette calloc failed");
+
+	int i;
+	for(i=0; i<VOLUME; i++)
+		index_set(indices, bits, i, index_get(palette->indices, palette->bits, i));
+
+	free(palette->indices);
+	palette->indices = indices;
+	palette->bits = bits;
+}
+
+palette_t *
+palette_create_from_dense(const block_t *blocks)
+{
+	palette_t *palette = malloc(sizeof(palette_t));
+	palette->len = 0;
+	palette->size = 16;
+	palette->entries = malloc(palette->size * sizeof(block_t));
+
+	uint8_t *tmp = malloc(VOLUME);
+
+	int i;
+	int last = -1;
+	for(i=0; i<VOLUME; i++)
+	{
+		if(last < 0 || memcmp(&palette->entries[last], &blocks[i], sizeof(block_t)))
+		{
+			last = find_entry(palette, &blocks[i]);
+			if(last < 0)
+				last = add_entry(palette, &blocks[i]);
+			if(last < 0)
+			{
+				free(tmp);
+				free(palette->entries);
+				free(palette);
+				return 0;
+			}
+		}
+		tmp[i] = last;
+	}
+
+	palette->bits = bits_for(palette->len);
+	palette->indices = calloc(1, indices_size(palette->bits));
+	if(!palette->indices)
+		fail("palette calloc failed");
+	for(i=0; i<VOLUME; i++)
+		index_set(palette->indices, palette->bits, i, tmp[i]);
+
+	free(tmp);
+	return palette;
+}
+
+void
+palette_destroy(palette_t *palette)
+{
+	free(palette->indices);
+	free(palette->entries);
+	free(palette);
+}
+
+block_t
+palette_get(int x, int y, int z, palette_t *palette)
+{
+	int i = x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE;
+	return palette->entries[index_get(palette->indices, palette->bits, i)];
+}
+
+int
+palette_set(int x, int y, int z, palette_t *palette, block_t *data)
+{
+	int entry = find_entry(palette, data);
+	if(entry < 0)
+	{
+		entry = add_entry(palette, data);
+		if(entry < 0)
+			return BLOCKS_FAIL;
+		if(palette->len > (1 << palette->bits))
+			repack(palette, palette->bits * 2);
+	}
+
+	index_set(palette->indices, palette->bits, x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE, entry);
+	return BLOCKS_SUCCESS;
+}
+
+void
+palette_to_dense(palette_t *palette, block_t *blocks)
+{
+	int i;
+	for(i=0; i<VOLUME; i++)
+		blocks[i] = palette->entries[index_get(palette->indices, palette->bits, i)];
+}
+
+size_t
+palette_memory_get(palette_t *palette)
+{
+	return sizeof(palette_t) + palette->size * sizeof(block_t) + indices_size(palette->bits);
+}
@@ -0,0 +1,23 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "chunk.h"
+
+#define PALETTE_MAX_ENTRIES 256
+
+typedef struct palette_s palette_t;
+
+palette_t *palette_create_from_dense(const block_t *blocks);
+void palette_destroy(palette_t *palette);
+
+block_t palette_get(int x, int y, int z, palette_t *palette);
+int palette_set(int x, int y, int z, palette_t *palette, block_t *data);
+
+void palette_to_dense(palette_t *palette, block_t *blocks);
+size_t palette_memory_get(palette_t *palette);
+
+#endif
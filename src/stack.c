@@ -119,7 +119,7 @@ stack_pop(struct stack *stack, void *data)
 void *
 stack_element_ref(stack_t* stack, size_t index)
 {
-	if(index >= stack->size / stack->object_size)
+	if(index >= (size_t)(stack->top - stack->data) / stack->object_size)
 		return 0;
 
 	void *ref = stack->data + stack->object_size * index;
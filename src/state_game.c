@@ -29,6 +29,7 @@ static int windowh = 0;
 static GLuint drawprogram;
 static GLuint viewprojectionmatrix;
 static GLuint modelmatrix;
+static GLint packedvertices;
 
 static GLuint ppprogram;
 static GLuint pppointbuffer;
@@ -163,6 +164,7 @@ state_game_init(void *ptr)
 
 	modelmatrix = glGetUniformLocation(drawprogram, "MODEL");
 	viewprojectionmatrix = glGetUniformLocation(drawprogram, "VP");
+	packedvertices = glGetUniformLocation(drawprogram, "PACKED");
 	postprocess_uniform_tex = glGetUniformLocation(ppprogram, "tex");
 	postprocess_uniform_depth = glGetUniformLocation(ppprogram, "depth");
 	postprocess_uniform_window_szie = glGetUniformLocation(ppprogram, "window_size");
@@ -231,7 +233,7 @@ state_game_init(void *ptr)
 	updatesem = SDL_CreateSemaphore(0);
 	updatethread = SDL_CreateThread(updatethreadfunc, "updatethread", 0);
 
-	textbox_fps = textbox_create(10, 10, 200, 100, "0fps", 0, TEXTBOX_FONT_ROBOTO_REGULAR, TEXTBOX_FONT_SIZE_MEDIUM, 0);
+	textbox_fps = textbox_create(10, 10, 480, 100, "0fps", 0, TEXTBOX_FONT_ROBOTO_REGULAR, TEXTBOX_FONT_SIZE_MEDIUM, 0);
 }
 
 static void
@@ -305,11 +307,14 @@ input()
 	}
 	if(keyboard[SDL_SCANCODE_X])
 	{
-		vec3_t dir;
-		for(dir.x = -1; dir.x < 1; dir.x += .3)
-		for(dir.y = -1; dir.y < 0; dir.y += .3)
-		for(dir.z = -1; dir.z < 1; dir.z += .3)
-			world_ray_del(&headpos, &dir, 1, 50);
+		//the blocks below and around the head, in one fill instead of a ray each
+		long3_t low = {floorf(headpos.x) - 3, floorf(headpos.y) - 3, floorf(headpos.z) - 3};
+		long3_t high = {floorf(headpos.x) + 4, floorf(headpos.y), floorf(headpos.z) + 4};
+
+		block_t b;
+		b.id = AIR;
+		b.metadata.number = 0;
+		world_block_fill_box(low, high, b, 1, 1);
 	}
 
 	headpos = *posptr;
@@ -346,6 +351,33 @@ state_game_event(void *ptr)
 			case SDLK_g:
 				gdb_break();
 			break;
+			case SDLK_b:
+				chunk_lock_benchmark();
+			break;
+			case SDLK_n:
+			{
+				//report on the mesher in use before switching to the next one
+				static const char *names[CHUNK_MESHER_NUM] = {"face", "greedy", "binary"};
+				long us;
+				long remeshes = chunk_remesh_stats_get(&us);
+				enum chunk_mesher m = chunk_mesher_get();
+				info("%s meshing: %li triangles, %li remeshes at %li us each", names[m], world_get_trianglecount(), remeshes, remeshes ? us / remeshes : 0);
+
+				chunk_mesher_set((m + 1) % CHUNK_MESHER_NUM);
+				world_remesh_all();
+			break;
+			}
+			case SDLK_k:
+				world_mesher_benchmark();
+			break;
+			case SDLK_o:
+			{
+				int packed = chunk_vertex_format_get() == CHUNK_VERTEX_PACKED;
+				chunk_vertex_format_set(packed ? CHUNK_VERTEX_INDEXED : CHUNK_VERTEX_PACKED);
+				info("%s vertices", packed ? "indexed" : "packed");
+				world_remesh_all();
+			break;
+			}
 			case SDLK_t:
 			{
 				vec3_t top = *posptr;
@@ -449,9 +481,18 @@ state_game_render()
 	frame++;
 	if(oneseccond >= 1000)
 	{
-		static char buffer[32];
-
-		snprintf(buffer, 32, "%ifps", frame);
+		static char buffer[96];
+
+		//average and worst time from an instant edit to its upload
+		long us, maxus;
+		long edits = chunk_edit_latency_get(&us, &maxus);
+		//chunks drawn, outside the frustum and behind solid ground in the last frame
+		long drawn, culled, hidden;
+		world_get_chunkcounts(&drawn, &culled, &hidden);
+		if(edits)
+			snprintf(buffer, 96, "%ifps %li/%li/%li chunks edit %.1f/%.1fms", frame, drawn, culled, hidden, us / 1000.0 / edits, maxus / 1000.0);
+		else
+			snprintf(buffer, 96, "%ifps %li/%li/%li chunks", frame, drawn, culled, hidden);
 		textbox_set_txt(textbox_fps, buffer);
 
 		oneseccond -= 1000;
@@ -497,7 +538,7 @@ state_game_render()
 
 	glUseProgram(drawprogram);
 	glUniformMatrix4fv(viewprojectionmatrix, 1, GL_FALSE, vp.mat);
-	world_render(*posptr, modelmatrix);
+	world_render(*posptr, &vp, modelmatrix, packedvertices);
 
 	if(lines)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -4,6 +4,9 @@
 #include "stack.h"
 #include "save.h"
 
+//neighbourhood of a water block, dy is -1 or 0
+#define AROUND(dx, dy, dz) around[((dx)+1) + ((dy)+1)*3 + ((dz)+1)*6]
+
 update_stack_t *
 update_stack_create()
 {
@@ -145,10 +148,16 @@ update_run_single(const struct update_node *update)
 		{
 			if(flags & UPDATE_FLAGS_FLOW_WATER)
 			{
+				//everywhere the water can flow to, read at once
+				block_t around[3*2*3];
+				long3_t low = {pos.x - 1, pos.y - 1, pos.z - 1};
+				long3_t high = {pos.x + 2, pos.y + 1, pos.z + 2};
+				world_blocks_get_box(low, high, around);
+
 				int waterinme = b.metadata.number;
 				if(waterinme > 0)
 				{ //flow down
-					block_t u = world_block_get(pos.x, pos.y -1, pos.z, 0);
+					block_t u = AROUND(0, -1, 0);
 					if(!BLOCK_PROPERTY_SOLID(u.id) && u.id != WATER && u.id != ERR)
 					{
 						u.id = WATER;
@@ -164,7 +173,7 @@ update_run_single(const struct update_node *update)
 				}
 				if(waterinme > 0)
 				{ //flow down
-					block_t u = world_block_get(pos.x+1, pos.y -1, pos.z, 0);
+					block_t u = AROUND(1, -1, 0);
 					if(!BLOCK_PROPERTY_SOLID(u.id) && u.id != WATER && u.id != ERR)
 					{
 						u.id = WATER;
@@ -180,7 +189,7 @@ update_run_single(const struct update_node *update)
 				}
 				if(waterinme > 0)
 				{ //flow down
-					block_t u = world_block_get(pos.x-1, pos.y -1, pos.z, 0);
+					block_t u = AROUND(-1, -1, 0);
 					if(!BLOCK_PROPERTY_SOLID(u.id) && u.id != WATER && u.id != ERR)
 					{
 						u.id = WATER;
@@ -196,7 +205,7 @@ update_run_single(const struct update_node *update)
 				}
 				if(waterinme > 0)
 				{ //flow down
-					block_t u = world_block_get(pos.x, pos.y -1, pos.z+1, 0);
+					block_t u = AROUND(0, -1, 1);
 					if(!BLOCK_PROPERTY_SOLID(u.id) && u.id != WATER && u.id != ERR)
 					{
 						u.id = WATER;
@@ -212,7 +221,7 @@ update_run_single(const struct update_node *update)
 				}
 				if(waterinme > 0)
 				{ //flow down
-					block_t u = world_block_get(pos.x, pos.y -1, pos.z-1, 0);
+					block_t u = AROUND(0, -1, -1);
 					if(!BLOCK_PROPERTY_SOLID(u.id) && u.id != WATER && u.id != ERR)
 					{
 						u.id = WATER;
@@ -232,10 +241,10 @@ update_run_single(const struct update_node *update)
 				if(waterinme > 0)
 				{ //flow sides
 					block_t u[4];
-					u[0] = world_block_get(pos.x+1, pos.y, pos.z, 0);
-					u[1] = world_block_get(pos.x-1, pos.y, pos.z, 0);
-					u[2] = world_block_get(pos.x, pos.y, pos.z+1, 0);
-					u[3] = world_block_get(pos.x, pos.y, pos.z-1, 0);
+					u[0] = AROUND(1, 0, 0);
+					u[1] = AROUND(-1, 0, 0);
+					u[2] = AROUND(0, 0, 1);
+					u[3] = AROUND(0, 0, -1);
 
 					int sum = waterinme;
 					int num = 1;
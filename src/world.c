@@ -31,13 +31,14 @@ static long3_t worldcenter = {0, 0, 0};
 
 static uint32_t seed;
 static long totalpoints=0;
+static long drawnchunks=0;
+static long culledchunks=0;
+static long hiddenchunks=0;
 
 static int stopthreads;
 static SDL_Thread *generationthread;
-static SDL_Thread *remeshthreadA; //entire world (slow)
-static SDL_Thread *remeshthreadB; //center of world (faster)
-static SDL_Thread *remeshthreadC; //Only "raycasted" updates (fasterer)
-static SDL_Thread *remeshthreadD; //Only "instant" updates (fastest)
+static SDL_Thread *remeshthreads[WORLD_REMESH_THREADS];
+static SDL_Thread *instantthread; //only remeshes instant edits, so they never wait behind a far chunk
 
 static entity_t *player = 0;
 
@@ -45,10 +46,28 @@ static save_t *save;
 
 struct {
 	chunk_t *chunk;
-	uint8_t instantremesh;
+	int queued; //slot in the remesh queue plus one, 0 when not queued
 	int generated;
 } data[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE];
 
+struct remesh_entry {
+	int3_t index;
+	int instant;
+	long distance; //squared, in chunks from the camera when queued
+};
+
+/*
+ * chunks waiting for a remesh, as a binary heap with instant edits first and
+ * then the chunks closest to the camera. A chunk is in it at most once.
+ */
+static struct {
+	SDL_mutex *lock;
+	SDL_cond *wake;
+	SDL_cond *wakeinstant; //an instant edit is at the top
+	struct remesh_entry heap[WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE];
+	int num;
+} remeshqueue;
+
 static inline long3_t
 get_worldpos_from_chunkpos(long3_t *cpos)
 {
@@ -125,6 +144,10 @@ save_chunk(int x, int y, int z)
 	long3_t pos;
 	size_t chunklen;
 
+	//untouched chunks are already in the save, or generate the same way again
+	if(!chunk_modified_get(data[x][y][z].chunk))
+		return BLOCKS_SUCCESS;
+
 	pos = chunk_pos_get(data[x][y][z].chunk);
 	chunklen = chunk_dump(data[x][y][z].chunk, &chunkdata);
 
@@ -137,17 +160,11 @@ save_chunk(int x, int y, int z)
 	return BLOCKS_SUCCESS;
 }
 
+//loaded neighbours of a chunk, 0 for the others
 static void
-remesh(int3_t *chunkindex)
+getneighbours(chunk_t *chunk, chunk_t **up, chunk_t **down, chunk_t **north, chunk_t **south, chunk_t **east, chunk_t **west)
 {
-	chunk_t *north=0;
-	chunk_t *south=0;
-	chunk_t *east=0;
-	chunk_t *west=0;
-	chunk_t *up=0;
-	chunk_t *down=0;
-
-	chunk_t *chunk = data[chunkindex->x][chunkindex->y][chunkindex->z].chunk;
+	*north = *south = *east = *west = *up = *down = 0;
 
 	int3_t tempchunkindex;
 	long3_t tempcpos = chunk_pos_get(chunk);
@@ -155,50 +172,206 @@ remesh(int3_t *chunkindex)
 	tempcpos.x++;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			east = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*east = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
 	tempcpos.x -= 2;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			west = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*west = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
 	tempcpos.x++;
 
 	tempcpos.y++;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			up = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*up = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
 	tempcpos.y -= 2;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			down = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*down = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
 	tempcpos.y++;
 
 	tempcpos.z++;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			south = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*south = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
 	tempcpos.z -= 2;
 	if(isquickloaded(tempcpos, &tempchunkindex))
 	{
-			north = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
+			*north = data[tempchunkindex.x][tempchunkindex.y][tempchunkindex.z].chunk;
 	}
+}
+
+static void
+remesh(int3_t *chunkindex, chunk_mesh_scratch_t *scratch)
+{
+	chunk_t *north, *south, *east, *west, *up, *down;
+	chunk_t *chunk = data[chunkindex->x][chunkindex->y][chunkindex->z].chunk;
+	getneighbours(chunk, &up, &down, &north, &south, &east, &west);
 
 	//re set up the buffers
-	chunk_remesh(chunk, up,down,north,south,east,west);
+	chunk_remesh(chunk, up,down,north,south,east,west, scratch);
+}
+
+static inline int
+remesh_before(const struct remesh_entry *a, const struct remesh_entry *b)
+{
+	if(a->instant != b->instant)
+		return a->instant;
+	return a->distance < b->distance;
+}
+
+static void
+remeshqueue_place(int slot, struct remesh_entry entry)
+{
+	remeshqueue.heap[slot] = entry;
+	data[entry.index.x][entry.index.y][entry.index.z].queued = slot + 1;
+}
+
+//moves the entry in slot up or down until the heap is ordered again
+static void
+remeshqueue_sift(int slot)
+{
+	struct remesh_entry entry = remeshqueue.heap[slot];
+
+	while(slot > 0 && remesh_before(&entry, &remeshqueue.heap[(slot - 1) / 2]))
+	{
+		remeshqueue_place(slot, remeshqueue.heap[(slot - 1) / 2]);
+		slot = (slot - 1) / 2;
+	}
+
+	while(1)
+	{
+		int child = slot*2 + 1;
+		if(child >= remeshqueue.num)
+			break;
+		if(child + 1 < remeshqueue.num && remesh_before(&remeshqueue.heap[child + 1], &remeshqueue.heap[child]))
+			child++;
+		if(!remesh_before(&remeshqueue.heap[child], &entry))
+			break;
+		remeshqueue_place(slot, remeshqueue.heap[child]);
+		slot = child;
+	}
+
+	remeshqueue_place(slot, entry);
+}
+
+//queues a chunk for the remesh threads, or moves it up if it already is
+static void
+remeshqueue_push(int3_t *chunkindex, int instant)
+{
+	//placeholders of chunks not generated yet go last
+	long distance = LONG_MAX;
+	long3_t cpos = chunk_pos_get(data[chunkindex->x][chunkindex->y][chunkindex->z].chunk);
+	if(shouldbequickloaded(cpos))
+	{
+		long3_t d = {cpos.x - worldcenter.x, cpos.y - worldcenter.y, cpos.z - worldcenter.z};
+		distance = d.x*d.x + d.y*d.y + d.z*d.z;
+	}
+
+	SDL_LockMutex(remeshqueue.lock);
+
+	int slot = data[chunkindex->x][chunkindex->y][chunkindex->z].queued - 1;
+	if(slot < 0)
+	{
+		slot = remeshqueue.num++;
+		remeshqueue.heap[slot].instant = 0;
+		SDL_CondSignal(remeshqueue.wake);
+	}
+
+	struct remesh_entry *entry = &remeshqueue.heap[slot];
+	if(instant && !entry->instant)
+		SDL_CondSignal(remeshqueue.wakeinstant);
+	entry->index = *chunkindex;
+	entry->instant = entry->instant || instant;
+	entry->distance = distance;
+	remeshqueue_sift(slot);
+
+	SDL_UnlockMutex(remeshqueue.lock);
+}
+
+//waits for a queued chunk, returns BLOCKS_FAIL once the threads are stopped
+static int
+remeshqueue_pop(int3_t *chunkindex, int instantonly)
+{
+	SDL_LockMutex(remeshqueue.lock);
+	if(instantonly)
+	{
+		while(!stopthreads && (remeshqueue.num == 0 || !remeshqueue.heap[0].instant))
+			SDL_CondWait(remeshqueue.wakeinstant, remeshqueue.lock);
+	} else {
+		while(!stopthreads && remeshqueue.num == 0)
+			SDL_CondWait(remeshqueue.wake, remeshqueue.lock);
+	}
+
+	if(stopthreads)
+	{
+		SDL_UnlockMutex(remeshqueue.lock);
+		return BLOCKS_FAIL;
+	}
+
+	*chunkindex = remeshqueue.heap[0].index;
+	data[chunkindex->x][chunkindex->y][chunkindex->z].queued = 0;
+
+	remeshqueue.num--;
+	if(remeshqueue.num > 0)
+	{
+		remeshqueue.heap[0] = remeshqueue.heap[remeshqueue.num];
+		remeshqueue_sift(0);
+	}
+
+	SDL_UnlockMutex(remeshqueue.lock);
+	return BLOCKS_SUCCESS;
 }
 
+//low is inclusive, high is exclusive
 static void
-queueremesh(int3_t *chunkindex, int instant)
+queueremesh(int3_t *chunkindex, int3_t low, int3_t high, int instant)
 {
-	if(instant)
-		data[chunkindex->x][chunkindex->y][chunkindex->z].instantremesh = 1;
+	chunk_mesh_clear_box(data[chunkindex->x][chunkindex->y][chunkindex->z].chunk, low, high, instant);
+	remeshqueue_push(chunkindex, instant);
+}
 
+//the whole chunk, after it was loaded or changed as a whole
+static void
+queueremeshall(int3_t *chunkindex)
+{
 	chunk_mesh_clear_current(data[chunkindex->x][chunkindex->y][chunkindex->z].chunk);
-	return;
+	remeshqueue_push(chunkindex, 0);
+}
+
+//remeshes around a changed block, including neighbours it shares a face with
+static void
+queueremeshblock(long3_t cpos, int3_t internalpos, int instant)
+{
+	int3_t chunkindex;
+	int3_t next = {internalpos.x + 1, internalpos.y + 1, internalpos.z + 1};
+	if(isquickloaded(cpos, &chunkindex))
+		queueremesh(&chunkindex, internalpos, next, instant);
+
+	int axis;
+	for(axis=0; axis<3; ++axis)
+	{
+		long *c = &cpos.x + axis;
+		int *i = &internalpos.x + axis;
+		int here = *i;
+		if(here != 0 && here != CHUNKSIZE-1)
+			continue;
+
+		//the neighbouring block on the other side of the border
+		int dir = here == 0 ? -1 : 1;
+		*c += dir;
+		*i = CHUNKSIZE-1 - here;
+		(&next.x)[axis] = *i + 1;
+		if(isquickloaded(cpos, &chunkindex))
+			queueremesh(&chunkindex, internalpos, next, instant);
+		*c -= dir;
+		*i = here;
+		(&next.x)[axis] = here + 1;
+	}
 }
 
 struct world_genthread_s {
@@ -211,6 +384,32 @@ struct world_genthread_s {
 	volatile int *counter;
 };
 
+//chunks further from the center than WORLD_LOD_DISTANCE are meshed coarser
+static int
+getlod(long3_t cpos)
+{
+	long ring = MAX(MAX(labs(cpos.x - worldcenter.x), labs(cpos.y - worldcenter.y)), labs(cpos.z - worldcenter.z));
+	return ring < WORLD_LOD_DISTANCE ? 0 : ring - WORLD_LOD_DISTANCE + 1;
+}
+
+//the chunk and the neighbours whose borders it covers
+static void
+queueremeshnear(int3_t chunkindex)
+{
+	int3_t near[7] = {
+		chunkindex,
+		{chunkindex.x == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.x+1, chunkindex.y, chunkindex.z},
+		{chunkindex.x == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.x-1, chunkindex.y, chunkindex.z},
+		{chunkindex.x, chunkindex.y == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.y+1, chunkindex.z},
+		{chunkindex.x, chunkindex.y == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.y-1, chunkindex.z},
+		{chunkindex.x, chunkindex.y, chunkindex.z == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.z+1},
+		{chunkindex.x, chunkindex.y, chunkindex.z == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.z-1}
+	};
+	int n;
+	for(n=0; n<7; ++n)
+		queueremeshall(&near[n]);
+}
+
 static int
 generationthreadfunc(void *ptr)
 {
@@ -258,15 +457,13 @@ generationthreadfunc(void *ptr)
 						if(ret != BLOCKS_SUCCESS)
 							worldgen_genchunk(context, chunk, &cpos);
 
-						chunk_mesh_clear_current(data[chunkindex.x == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.x+1][chunkindex.y][chunkindex.z].chunk);
-						chunk_mesh_clear_current(data[chunkindex.x == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.x-1][chunkindex.y][chunkindex.z].chunk);
-						chunk_mesh_clear_current(data[chunkindex.x][chunkindex.y == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.y+1][chunkindex.z].chunk);
-						chunk_mesh_clear_current(data[chunkindex.x][chunkindex.y == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.y-1][chunkindex.z].chunk);
-						chunk_mesh_clear_current(data[chunkindex.x][chunkindex.y][chunkindex.z == WORLD_CHUNKS_PER_EDGE-1 ? 0 : chunkindex.z+1].chunk);
-						chunk_mesh_clear_current(data[chunkindex.x][chunkindex.y][chunkindex.z == 0 ? WORLD_CHUNKS_PER_EDGE-1 : chunkindex.z-1].chunk);
+						chunk_lod_set(chunk, getlod(cpos));
+						queueremeshnear(chunkindex);
 
 						if(counter)
 							++(*counter);
+					} else if(chunk_lod_set(data[chunkindex.x][chunkindex.y][chunkindex.z].chunk, getlod(cpos))) {
+						queueremeshnear(chunkindex);
 					}
 				}
 			}
@@ -278,154 +475,17 @@ generationthreadfunc(void *ptr)
 	return 0;
 }
 
-//FULL REMESH
+//ptr is non zero for the thread only taking instant edits
 static int
-remeshthreadfuncA(void *ptr)
+remeshthreadfunc(void *ptr)
 {
-	while(!stopthreads)
-	{
-		int3_t i;
-		for(i.x = 0; i.x< WORLD_CHUNKS_PER_EDGE; ++i.x)
-		{
-			if(stopthreads)
-				break;
-			for(i.y = 0; i.y< WORLD_CHUNKS_PER_EDGE; ++i.y)
-			{
-				if(stopthreads)
-					break;
-				for(i.z = 0; i.z< WORLD_CHUNKS_PER_EDGE; ++i.z)
-				{
-					if(stopthreads)
-						break;
-
-					if(!chunk_mesh_is_current(data[i.x][i.y][i.z].chunk))
-						remesh(&i);
-				}
-			}
-		}
+	chunk_mesh_scratch_t *scratch = chunk_mesh_scratch_create();
 
-		if(!stopthreads)
-			SDL_Delay(80);
-	}
-	return 0;
-}
-
-//MIDDLE WORLD REMESH
-static int
-remeshthreadfuncB(void *ptr)
-{
-	while(!stopthreads)
-	{
-		long3_t i;
-		long3_t lowbound = {
-			worldcenter.x - WORLD_CHUNKS_PER_EDGE/6,
-			worldcenter.y - WORLD_CHUNKS_PER_EDGE/6,
-			worldcenter.z - WORLD_CHUNKS_PER_EDGE/6
-		};
-		long3_t highbound = {
-			worldcenter.x + WORLD_CHUNKS_PER_EDGE/6,
-			worldcenter.y + WORLD_CHUNKS_PER_EDGE/6,
-			worldcenter.z + WORLD_CHUNKS_PER_EDGE/6
-		};
-		for(i.x = lowbound.x; i.x< highbound.x; ++i.x)
-		{
-			if(stopthreads)
-				break;
-			for(i.y = lowbound.y; i.y< highbound.y; ++i.y)
-			{
-				if(stopthreads)
-					break;
-				for(i.z = lowbound.z; i.z< highbound.z; ++i.z)
-				{
-					int3_t icpo = getchunkindexofchunk(i);
-					if(stopthreads)
-						break;
-
-					if(!chunk_mesh_is_current(data[icpo.x][icpo.y][icpo.z].chunk))
-						remesh(&icpo);
-				}
-			}
-		}
-
-		if(!stopthreads)
-			SDL_Delay(80);
-	}
-	return 0;
-}
-
-//RAYCAST REMESH
-static int
-remeshthreadfuncC(void *ptr)
-{
-	{
-		vec3_t i;
-		for(i.x = -WORLD_CHUNKS_PER_EDGE; i.x < WORLD_CHUNKS_PER_EDGE; ++i.x)
-		{
-			if(stopthreads)
-				break;
-			for(i.y = -WORLD_CHUNKS_PER_EDGE; i.y < WORLD_CHUNKS_PER_EDGE; ++i.y)
-			{
-				if(stopthreads)
-					break;
-				for(i.z = -WORLD_CHUNKS_PER_EDGE; i.z < WORLD_CHUNKS_PER_EDGE; ++i.z)
-				{
-					if(stopthreads)
-						break;
-
-					vec3_t begin_point = worldcenterpos;
-					begin_point.y += PLAYER_EYEHEIGHT;
-
-					long3_t pos = world_ray_pos(&begin_point, &i, 0, 1000);
-					pos = world_get_chunkpos_of_worldpos(pos.x, pos.y, pos.z);
-
-					int3_t icpo = getchunkindexofchunk(pos);
-
-					if(!chunk_mesh_is_current(data[icpo.x][icpo.y][icpo.z].chunk))
-						remesh(&icpo);
-				}
-			}
-		}
-
-		if(!stopthreads)
-			SDL_Delay(80);
-	}
-	return 0;
-}
-
-//FAST REMESH
-static int
-remeshthreadfuncD(void *ptr)
-{
-	while(!stopthreads)
-	{
-		uint32_t ticks = SDL_GetTicks();
-		int3_t i;
-		for(i.x = 0; i.x< WORLD_CHUNKS_PER_EDGE; ++i.x)
-		{
-			if(stopthreads)
-				break;
-			for(i.y = 0; i.y< WORLD_CHUNKS_PER_EDGE; ++i.y)
-			{
-				if(stopthreads)
-					break;
-				for(i.z = 0; i.z< WORLD_CHUNKS_PER_EDGE; ++i.z)
-				{
-					if(stopthreads)
-						break;
-
-					if(data[i.x][i.y][i.z].instantremesh)
-					{
-						data[i.x][i.y][i.z].instantremesh = 0;
-						remesh(&i);
-					}
-				}
-			}
-		}
+	int3_t chunkindex;
+	while(remeshqueue_pop(&chunkindex, ptr != 0) == BLOCKS_SUCCESS)
+		remesh(&chunkindex, scratch);
 
-		uint32_t ticksdiff = SDL_GetTicks() - ticks;
-		if(ticksdiff < 100)
-			SDL_Delay(100 - ticksdiff); //Don't run this function more than 10 times a seccond
-	}
+	chunk_mesh_scratch_destroy(scratch);
 	return 0;
 }
 
@@ -496,10 +556,9 @@ generate_new_world_func(void *ptr)
 	SDL_SemWait(wginfo.initalized);
 	SDL_DestroySemaphore(wginfo.initalized);
 
-	remeshthreadA = SDL_CreateThread(remeshthreadfuncA, "world_remeshA", 0);
-	remeshthreadB = SDL_CreateThread(remeshthreadfuncB, "world_remeshB", 0);
-	remeshthreadC = SDL_CreateThread(remeshthreadfuncC, "world_remeshC", 0);
-	remeshthreadD = SDL_CreateThread(remeshthreadfuncD, "world_remeshD", 0);
+	for(i=0; i<WORLD_REMESH_THREADS; ++i)
+		remeshthreads[i] = SDL_CreateThread(remeshthreadfunc, "world_remesh", 0);
+	instantthread = SDL_CreateThread(remeshthreadfunc, "world_remesh_instant", &instantthread);
 
 	*status = -1;
 	is_initalized = 1;
@@ -567,9 +626,14 @@ world_init(vec3_t pos)
 	for(cpos.y = 0; cpos.y<WORLD_CHUNKS_PER_EDGE; ++cpos.y)
 	{
 		data[cpos.x][cpos.y][cpos.z].chunk = 0;
-		data[cpos.x][cpos.y][cpos.z].instantremesh = 0;
+		data[cpos.x][cpos.y][cpos.z].queued = 0;
 	}
 
+	remeshqueue.lock = SDL_CreateMutex();
+	remeshqueue.wake = SDL_CreateCond();
+	remeshqueue.wakeinstant = SDL_CreateCond();
+	remeshqueue.num = 0;
+
 	return 1;
 }
 
@@ -686,11 +750,19 @@ world_cleanup()
 
 	stopthreads=1;
 
+	SDL_LockMutex(remeshqueue.lock);
+	SDL_CondBroadcast(remeshqueue.wake);
+	SDL_CondBroadcast(remeshqueue.wakeinstant);
+	SDL_UnlockMutex(remeshqueue.lock);
+
 	SDL_WaitThread(generationthread, 0);
-	SDL_WaitThread(remeshthreadA, 0);
-	SDL_WaitThread(remeshthreadB, 0);
-	SDL_WaitThread(remeshthreadC, 0);
-	SDL_WaitThread(remeshthreadD, 0);
+	int i;
+	for(i=0; i<WORLD_REMESH_THREADS; ++i)
+		SDL_WaitThread(remeshthreads[i], 0);
+	SDL_WaitThread(instantthread, 0);
+	SDL_DestroyCond(remeshqueue.wake);
+	SDL_DestroyCond(remeshqueue.wakeinstant);
+	SDL_DestroyMutex(remeshqueue.lock);
 
 	world_save();
 
@@ -707,34 +779,152 @@ world_cleanup()
 	is_initalized = 0;
 }
 
+//the step to the neighbour through each face, in the order of enum block_face
+static const int facestep[6][3] = {{0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {-1, 0, 0}};
+
+/*
+ * searches from the camera chunk through the faces each chunk connects with
+ * open space, only stepping away from the camera and staying in the frustum.
+ * Sets entered of each chunk index it reaches to the faces it came in
+ * through, chunks it doesn't reach are hidden behind solid ground.
+ */
+static void
+findvisible(uint8_t infrustum[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE], uint8_t entered[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE])
+{
+	//offsets in the world scope, a chunk is in the queue at most once
+	int3_t queue[WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE];
+	uint8_t queued[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE];
+	int head = 0;
+	int num = 0;
+	memset(queued, 0, sizeof(queued));
+	memset(entered, 0, sizeof(queued));
+
+	int3_t center = {WORLD_CHUNKS_PER_EDGE/2, WORLD_CHUNKS_PER_EDGE/2, WORLD_CHUNKS_PER_EDGE/2};
+	int3_t ci = getchunkindexofchunk(worldcenter);
+	entered[ci.x][ci.y][ci.z] = (1 << 6) - 1;
+	queued[ci.x][ci.y][ci.z] = 1;
+	queue[num++] = center;
+
+	while(num)
+	{
+		int3_t o = queue[head];
+		head = (head + 1) % (WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE);
+		--num;
+
+		long3_t cpos = {worldscope.x + o.x, worldscope.y + o.y, worldscope.z + o.z};
+		int loaded = isquickloaded(cpos, &ci);
+		queued[ci.x][ci.y][ci.z] = 0;
+
+		//the camera may be anywhere in its chunk, and chunks not loaded yet hide nothing
+		int out = 0;
+		int t;
+		if(!loaded || memcmp(&o, &center, sizeof(int3_t)) == 0)
+			out = (1 << 6) - 1;
+		else
+			for(t=0; t<6; ++t)
+				if(entered[ci.x][ci.y][ci.z] & 1 << t)
+					out |= chunk_visibility_get(data[ci.x][ci.y][ci.z].chunk, t);
+
+		for(t=0; t<6; ++t)
+		{
+			int3_t n = {o.x + facestep[t][0], o.y + facestep[t][1], o.z + facestep[t][2]};
+			if(!(out & 1 << t) ||
+					facestep[t][0] * (o.x - center.x) < 0 ||
+					facestep[t][1] * (o.y - center.y) < 0 ||
+					facestep[t][2] * (o.z - center.z) < 0)
+				continue;
+			if(n.x < 0 || n.x >= WORLD_CHUNKS_PER_EDGE ||
+					n.y < 0 || n.y >= WORLD_CHUNKS_PER_EDGE ||
+					n.z < 0 || n.z >= WORLD_CHUNKS_PER_EDGE)
+				continue;
+
+			long3_t npos = {worldscope.x + n.x, worldscope.y + n.y, worldscope.z + n.z};
+			int3_t ni = getchunkindexofchunk(npos);
+			int face = 1 << (t ^ 1);
+			if(!infrustum[ni.x][ni.y][ni.z] || entered[ni.x][ni.y][ni.z] & face)
+				continue;
+
+			//a chunk reached through another face may see further, so it is searched again
+			entered[ni.x][ni.y][ni.z] |= face;
+			if(!queued[ni.x][ni.y][ni.z])
+			{
+				queued[ni.x][ni.y][ni.z] = 1;
+				queue[(head + num) % (WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE)] = n;
+				++num;
+			}
+		}
+	}
+}
+
 void
-world_render(vec3_t pos, GLuint modelmatrix)
+world_render(vec3_t pos, mat4_t *vp, GLuint modelmatrix, GLint packeduniform)
 {
 	setworldcenter(pos);
 	glEnable(GL_DEPTH_TEST);
 
+	//vp is relative to pos, like the model matrices
+	vec4_t planes[6];
+	getfrustumplanes(planes, vp);
+
 	int x=0;
 	int y=0;
 	int z=0;
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	uint8_t infrustum[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE];
+	for(x=0; x<WORLD_CHUNKS_PER_EDGE; ++x)
+	for(y=0; y<WORLD_CHUNKS_PER_EDGE; ++y)
+	for(z=0; z<WORLD_CHUNKS_PER_EDGE; ++z)
+	{
+		long3_t chunkpos = chunk_pos_get(data[x][y][z].chunk);
+		long3_t worldpos = get_worldpos_from_chunkpos(&chunkpos);
+
+		//the wobble moves vertices slightly outside the chunk
+		vec3_t low = {worldpos.x - pos.x - RENDER_WOBBLE, worldpos.y - pos.y - RENDER_WOBBLE, worldpos.z - pos.z - RENDER_WOBBLE};
+		vec3_t high = {low.x + CHUNKSIZE + 2*RENDER_WOBBLE, low.y + CHUNKSIZE + 2*RENDER_WOBBLE, low.z + CHUNKSIZE + 2*RENDER_WOBBLE};
+		infrustum[x][y][z] = boxinfrustum(planes, low, high);
+	}
+
+	uint8_t entered[WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE][WORLD_CHUNKS_PER_EDGE];
+	findvisible(infrustum, entered);
 
+	//chunk_render enables the vertex attributes of each chunks format
 	long points = 0;
+	long drawn = 0;
+	long culled = 0;
+	long hidden = 0;
 
 	for(x=0; x<WORLD_CHUNKS_PER_EDGE; ++x)
 	for(y=0; y<WORLD_CHUNKS_PER_EDGE; ++y)
 	for(z=0; z<WORLD_CHUNKS_PER_EDGE; ++z)
 	{
+		if(!infrustum[x][y][z] || !entered[x][y][z])
+		{
+			//keep the buffer current so the chunk is ready when it turns into view
+			chunk_upload(data[x][y][z].chunk);
+			if(!infrustum[x][y][z])
+				++culled;
+			else
+				++hidden;
+			continue;
+		}
+
 		long3_t chunkpos = chunk_pos_get(data[x][y][z].chunk);
 		long3_t worldpos = get_worldpos_from_chunkpos(&chunkpos);
-		mat4_t matrix = gettranslatematrix(worldpos.x - pos.x, worldpos.y - pos.y, worldpos.z - pos.z);
+		vec3_t offset = {worldpos.x - pos.x, worldpos.y - pos.y, worldpos.z - pos.z};
+		mat4_t matrix = gettranslatematrix(offset.x, offset.y, offset.z);
 		glUniformMatrix4fv(modelmatrix, 1, GL_FALSE, matrix.mat);
 
-		points += chunk_render(data[x][y][z].chunk);
+		long chunkpoints = chunk_render(data[x][y][z].chunk, packeduniform);
+		if(chunkpoints)
+			++drawn;
+		points += chunkpoints;
 	}
+	glDisableVertexAttribArray(2);
 
 	totalpoints = points;
+	drawnchunks = drawn;
+	culledchunks = culled;
+	hiddenchunks = hidden;
 }
 
 //TODO: loadnew
@@ -767,6 +957,120 @@ world_block_get_id(long x, long y, long z, int loadnew)
 	return ERR;
 }
 
+//TODO: loadnew
+int
+world_block_solid(long x, long y, long z, int loadnew)
+{
+	long3_t cpos = world_get_chunkpos_of_worldpos(x, y, z);
+	int3_t internalpos = world_get_internalpos_of_worldpos(x,y,z);
+
+	int3_t icpo;
+	if(isquickloaded(cpos, &icpo))
+		return chunk_block_solid(data[icpo.x][icpo.y][icpo.z].chunk, internalpos.x, internalpos.y, internalpos.z);
+
+	return BLOCK_PROPERTY_SOLID(ERR);
+}
+
+/*
+ * like world_blocks_get_box, but only the solidity of each block as 0 or 1
+ * from the bitsets of the chunks
+ */
+int
+world_solid_get_box(long3_t low, long3_t high, uint8_t *out)
+{
+	long3_t size = {high.x - low.x, high.y - low.y, high.z - low.z};
+	if(size.x <= 0 || size.y <= 0 || size.z <= 0)
+		return -1;
+
+	memset(out, BLOCK_PROPERTY_SOLID(ERR), size.x*size.y*size.z);
+
+	int ret = -1;
+
+	long3_t clow = world_get_chunkpos_of_worldpos(low.x, low.y, low.z);
+	long3_t chigh = world_get_chunkpos_of_worldpos(high.x - 1, high.y - 1, high.z - 1);
+
+	long3_t cpos;
+	for(cpos.x = clow.x; cpos.x <= chigh.x; ++cpos.x)
+	for(cpos.y = clow.y; cpos.y <= chigh.y; ++cpos.y)
+	for(cpos.z = clow.z; cpos.z <= chigh.z; ++cpos.z)
+	{
+		int3_t chunkindex;
+		if(!isquickloaded(cpos, &chunkindex))
+			continue;
+
+		long3_t origin = get_worldpos_from_chunkpos(&cpos);
+		int3_t ilow = {
+			MAX(low.x - origin.x, 0),
+			MAX(low.y - origin.y, 0),
+			MAX(low.z - origin.z, 0)
+		};
+		int3_t ihigh = {
+			MIN(high.x - origin.x, CHUNKSIZE),
+			MIN(high.y - origin.y, CHUNKSIZE),
+			MIN(high.z - origin.z, CHUNKSIZE)
+		};
+
+		uint8_t *dst = &out[(origin.x + ilow.x - low.x) + (origin.y + ilow.y - low.y)*size.x + (origin.z + ilow.z - low.z)*size.x*size.y];
+		chunk_solid_get_box(data[chunkindex.x][chunkindex.y][chunkindex.z].chunk, ilow, ihigh, dst, size.x, size.x*size.y);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * copies a box, low inclusive and high exclusive, into out with x varying
+ * fastest, then y, then z. Each chunk it touches is locked once. Blocks in
+ * chunks that are not loaded read as ERR.
+ */
+int
+world_blocks_get_box(long3_t low, long3_t high, block_t *out)
+{
+	long3_t size = {high.x - low.x, high.y - low.y, high.z - low.z};
+	if(size.x <= 0 || size.y <= 0 || size.z <= 0)
+		return -1;
+
+	long i;
+	for(i=0; i<size.x*size.y*size.z; ++i)
+	{
+		out[i].id = ERR;
+		out[i].metadata.number = 0;
+	}
+
+	int ret = -1;
+
+	long3_t clow = world_get_chunkpos_of_worldpos(low.x, low.y, low.z);
+	long3_t chigh = world_get_chunkpos_of_worldpos(high.x - 1, high.y - 1, high.z - 1);
+
+	long3_t cpos;
+	for(cpos.x = clow.x; cpos.x <= chigh.x; ++cpos.x)
+	for(cpos.y = clow.y; cpos.y <= chigh.y; ++cpos.y)
+	for(cpos.z = clow.z; cpos.z <= chigh.z; ++cpos.z)
+	{
+		int3_t chunkindex;
+		if(!isquickloaded(cpos, &chunkindex))
+			continue;
+
+		long3_t origin = get_worldpos_from_chunkpos(&cpos);
+		int3_t ilow = {
+			MAX(low.x - origin.x, 0),
+			MAX(low.y - origin.y, 0),
+			MAX(low.z - origin.z, 0)
+		};
+		int3_t ihigh = {
+			MIN(high.x - origin.x, CHUNKSIZE),
+			MIN(high.y - origin.y, CHUNKSIZE),
+			MIN(high.z - origin.z, CHUNKSIZE)
+		};
+
+		block_t *dst = &out[(origin.x + ilow.x - low.x) + (origin.y + ilow.y - low.y)*size.x + (origin.z + ilow.z - low.z)*size.x*size.y];
+		chunk_blocks_get_box(data[chunkindex.x][chunkindex.y][chunkindex.z].chunk, ilow, ihigh, dst, size.x, size.x*size.y);
+		ret = 0;
+	}
+
+	return ret;
+}
+
 //TODO: loadnew
 int
 world_block_set(long x, long y, long z, block_t block, int update, int loadnew, int instant)
@@ -792,33 +1096,7 @@ world_block_set(long x, long y, long z, block_t block, int update, int loadnew,
 			world_update_queue(x,y,z-1, update-1, 0);
 		}
 
-		queueremesh(&chunkindex, instant);
-
-		cpos.x++;
-		if(internalpos.x == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-
-		cpos.x -= 2;
-		if(internalpos.x == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-		cpos.x++;
-
-		cpos.y++;
-		if(internalpos.y == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-
-		cpos.y -= 2;
-		if(internalpos.y == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-		cpos.y++;
-
-		cpos.z++;
-		if(internalpos.z == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-
-		cpos.z -= 2;
-		if(internalpos.z == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
+		queueremeshblock(cpos, internalpos, instant);
 
 		return 0;
 	}
@@ -850,37 +1128,67 @@ world_block_set_id(long x, long y, long z, blockid_t id, int update, int loadnew
 			world_update_queue(x,y,z-1, update-1, 0);
 		}
 
-		queueremesh(&chunkindex, instant);
-
-		cpos.x++;
-		if(internalpos.x == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
+		queueremeshblock(cpos, internalpos, instant);
 
-		cpos.x -= 2;
-		if(internalpos.x == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-		cpos.x++;
+		return 0;
+	}
+	return -1;
+}
 
-		cpos.y++;
-		if(internalpos.y == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
+//low is inclusive, high is exclusive
+int
+world_block_fill_box(long3_t low, long3_t high, block_t block, int update, int instant)
+{
+	int ret = -1;
 
-		cpos.y -= 2;
-		if(internalpos.y == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
-		cpos.y++;
+	//chunks touching the box from outside need a remesh too
+	long3_t clow = world_get_chunkpos_of_worldpos(low.x - 1, low.y - 1, low.z - 1);
+	long3_t chigh = world_get_chunkpos_of_worldpos(high.x, high.y, high.z);
 
-		cpos.z++;
-		if(internalpos.z == CHUNKSIZE-1 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
+	long3_t cpos;
+	for(cpos.x = clow.x; cpos.x <= chigh.x; ++cpos.x)
+	for(cpos.y = clow.y; cpos.y <= chigh.y; ++cpos.y)
+	for(cpos.z = clow.z; cpos.z <= chigh.z; ++cpos.z)
+	{
+		int3_t chunkindex;
+		if(!isquickloaded(cpos, &chunkindex))
+			continue;
+
+		long3_t origin = get_worldpos_from_chunkpos(&cpos);
+		int3_t ilow = {
+			MAX(low.x - origin.x, -1),
+			MAX(low.y - origin.y, -1),
+			MAX(low.z - origin.z, -1)
+		};
+		int3_t ihigh = {
+			MIN(high.x - origin.x, CHUNKSIZE+1),
+			MIN(high.y - origin.y, CHUNKSIZE+1),
+			MIN(high.z - origin.z, CHUNKSIZE+1)
+		};
 
-		cpos.z -= 2;
-		if(internalpos.z == 0 && isquickloaded(cpos, &chunkindex))
-			queueremesh(&chunkindex, instant);
+		chunk_fill_box(data[chunkindex.x][chunkindex.y][chunkindex.z].chunk, ilow, ihigh, block);
+		queueremesh(&chunkindex, ilow, ihigh, instant);
+		ret = 0;
+	}
 
-		return 0;
+	if(update && ret == 0)
+	{
+		//only the layers on either side of the boxes surface can change
+		long x, y, z;
+		for(x = low.x - 1; x <= high.x; ++x)
+		for(y = low.y - 1; y <= high.y; ++y)
+		{
+			int inside = low.x < x && x < high.x - 1 && low.y < y && y < high.y - 1;
+			for(z = low.z - 1; z <= high.z; ++z)
+			{
+				if(inside && z == low.z + 1 && high.z - 1 > z)
+					z = high.z - 1;
+				world_update_queue(x, y, z, update-1, 0);
+			}
+		}
 	}
-	return -1;
+
+	return ret;
 }
 
 uint32_t
@@ -910,6 +1218,57 @@ world_update_queue(long x, long y, long z, uint8_t time, update_flags_t flags)
 	}
 }
 
+struct recompress_candidate {
+	chunk_t *chunk;
+	double score;
+};
+
+static int
+compare_candidates(const void *a, const void *b)
+{
+	double sa = ((const struct recompress_candidate *)a)->score;
+	double sb = ((const struct recompress_candidate *)b)->score;
+	return (sa > sb) - (sa < sb);
+}
+
+/*
+ * recompresses raw and palette chunks until they fit the budget again.
+ * Chunks that are rarely touched and far from the player go first.
+ */
+static void
+enforce_memory_budget()
+{
+	size_t total = chunk_memory_uncompressed_get();
+	if(total <= CHUNK_UNCOMPRESSED_BUDGET)
+		return;
+
+	static struct recompress_candidate candidates[WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE*WORLD_CHUNKS_PER_EDGE];
+	int num = 0;
+
+	int x, y, z;
+	for(x=0; x<WORLD_CHUNKS_PER_EDGE; ++x)
+	for(y=0; y<WORLD_CHUNKS_PER_EDGE; ++y)
+	for(z=0; z<WORLD_CHUNKS_PER_EDGE; ++z)
+	{
+		chunk_t *chunk = data[x][y][z].chunk;
+		if(!chunk_uncompressed_size_get(chunk))
+			continue;
+
+		long3_t cpos = chunk_pos_get(chunk);
+		long dist = MAX(MAX(labs(cpos.x - worldcenter.x), labs(cpos.y - worldcenter.y)), labs(cpos.z - worldcenter.z));
+
+		candidates[num].chunk = chunk;
+		candidates[num].score = (chunk_activity_get(chunk) + 1) / (double)(dist + 1);
+		num++;
+	}
+
+	qsort(candidates, num, sizeof(struct recompress_candidate), compare_candidates);
+
+	int i;
+	for(i=0; i<num && total > CHUNK_UNCOMPRESSED_BUDGET; ++i)
+		total -= chunk_recompress(candidates[i].chunk);
+}
+
 long
 world_update_flush()
 {
@@ -920,11 +1279,66 @@ world_update_flush()
 	for(z=0; z<WORLD_CHUNKS_PER_EDGE; ++z)
 		num += chunk_update_run(data[x][y][z].chunk);
 
+	enforce_memory_budget();
+
 	return num;
 }
 
+//after switching the mesher
+void
+world_remesh_all()
+{
+	int3_t i;
+	for(i.x = 0; i.x<WORLD_CHUNKS_PER_EDGE; ++i.x)
+	for(i.y = 0; i.y<WORLD_CHUNKS_PER_EDGE; ++i.y)
+	for(i.z = 0; i.z<WORLD_CHUNKS_PER_EDGE; ++i.z)
+		if(data[i.x][i.y][i.z].chunk)
+			queueremeshall(&i);
+}
+
+//times every mesher on the loaded chunks and logs the results
+void
+world_mesher_benchmark()
+{
+	static const char *names[CHUNK_MESHER_NUM] = {"face", "greedy", "binary"};
+	long us[CHUNK_MESHER_NUM] = {0};
+	long triangles[CHUNK_MESHER_NUM] = {0};
+	long mismatches = 0;
+	long chunks = 0;
+
+	int3_t i;
+	for(i.x = 0; i.x<WORLD_CHUNKS_PER_EDGE; ++i.x)
+	for(i.y = 0; i.y<WORLD_CHUNKS_PER_EDGE; ++i.y)
+	for(i.z = 0; i.z<WORLD_CHUNKS_PER_EDGE; ++i.z)
+	{
+		chunk_t *chunk = data[i.x][i.y][i.z].chunk;
+		if(!chunk)
+			continue;
+
+		chunk_t *north, *south, *east, *west, *up, *down;
+		getneighbours(chunk, &up, &down, &north, &south, &east, &west);
+		mismatches += chunk_mesher_benchmark(chunk, up,down,north,south,east,west, us, triangles);
+		chunks++;
+	}
+
+	int m;
+	for(m=0; m<CHUNK_MESHER_NUM; ++m)
+		info("mesher benchmark: %s %li us per chunk, %li triangles", names[m], chunks ? us[m] / chunks : 0, triangles[m]);
+	if(mismatches)
+		error("mesher benchmark: binary mesh differs from face mesh in %li indices", mismatches);
+}
+
 long
 world_get_trianglecount()
 {
 	return totalpoints / 3;
 }
+
+//chunks drawn, outside the view and in view but behind solid ground in the last frame, empty chunks that were reached count as none
+void
+world_get_chunkcounts(long *drawn, long *culled, long *hidden)
+{
+	*drawn = drawnchunks;
+	*culled = culledchunks;
+	*hidden = hiddenchunks;
+}
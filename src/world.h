@@ -23,17 +23,24 @@ void world_seed_gen();
 uint32_t world_get_seed();
 void world_set_seed(uint32_t new_seed);
 
-void world_render(vec3_t pos, GLuint modelmatrix);
+void world_render(vec3_t pos, mat4_t *vp, GLuint modelmatrix, GLint packeduniform);
 
 block_t world_block_get(long x, long y, long z, int loadnew);
 blockid_t world_block_get_id(long x, long y, long z, int loadnew);
+int world_blocks_get_box(long3_t low, long3_t high, block_t *out);
+int world_block_solid(long x, long y, long z, int loadnew);
+int world_solid_get_box(long3_t low, long3_t high, uint8_t *out);
 int world_block_set(long x, long y, long z, block_t block, int update, int loadnew, int instant);
 int world_block_set_id(long x, long y, long z, blockid_t id, int update, int loadnew, int instant);
+int world_block_fill_box(long3_t low, long3_t high, block_t block, int update, int instant);
 
 void world_update_queue(long x, long y, long z, uint8_t time, update_flags_t flags);
 long world_update_flush();
 
 long world_get_trianglecount();
+void world_get_chunkcounts(long *drawn, long *culled, long *hidden);
+void world_remesh_all();
+void world_mesher_benchmark();
 
 static inline long3_t
 world_get_chunkpos_of_worldpos(long x, long y, long z)
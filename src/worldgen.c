@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "world.h"
 #include "custommath.h"
@@ -17,6 +18,7 @@ struct worldgen_s {
 	long3_t lastdiasquareblockpos;
 	double heightmap[(CHUNKSIZE+1)*(CHUNKSIZE+1)];
 	double metaheightmap[(DIAMONDSQUARESIZE+1)*(DIAMONDSQUARESIZE+1)];
+	block_t blocks[CHUNKSIZE*CHUNKSIZE*CHUNKSIZE];
 };
 
 worldgen_t defaultcontext = {
@@ -240,6 +242,9 @@ worldgen_genchunk(worldgen_t *context, chunk_t *chunk, long3_t *cpos)
 		}
 	};
 
+	block_t *blocks = context->blocks;
+	memset(blocks, 0, sizeof(context->blocks));
+
 	int x, y, z;
 	for(x=0; x<CHUNKSIZE; ++x)
 	for(z=0; z<CHUNKSIZE; ++z)
@@ -247,23 +252,25 @@ worldgen_genchunk(worldgen_t *context, chunk_t *chunk, long3_t *cpos)
 	{
 		double height = getheightval(context, x, z);
 		int32_t blockheight = y + newchunkblockpos.y;
+		block_t *block = &blocks[x + y*CHUNKSIZE + z*CHUNKSIZE*CHUNKSIZE];
 		if(blockheight < height - 100)
-			chunk_block_set_id(chunk, x, y, z, BEDROCK);
+			block->id = BEDROCK;
 		else if(blockheight < height - 20)
-			chunk_block_set_id(chunk, x, y, z, STONE);
+			block->id = STONE;
 		else if(blockheight < height - 3)
-			chunk_block_set_id(chunk, x, y, z, DIRT);
+			block->id = DIRT;
 		else if(blockheight < height)
 			if(height < .55)
-				chunk_block_set_id(chunk, x, y, z, SAND);
+				block->id = SAND;
 			else
-				chunk_block_set_id(chunk, x, y, z, GRASS);
+				block->id = GRASS;
 		else if(blockheight < 0)
-			chunk_block_set(chunk, x, y, z, water);
+			*block = water;
 		else
 			break;
 	}
 
+	chunk_fill_dense(chunk, blocks);
 	chunk_unlock(chunk);
 }
 